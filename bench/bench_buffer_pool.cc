@@ -0,0 +1,228 @@
+// 缓冲区申请释放的吞吐: CBufferPool 对比 glibc malloc/realloc/free.
+//   churn:   每个线程维持 window 个活着的缓冲区(模拟同时在处理的连接), 每一步随机释放一个,
+//            再申请一个新的, 大小在 256B~128KB 之间按对数均匀分布, 一半会再扩容一次(写响应时变大)
+//   handoff: 线程两两配对, 一个申请(收到请求), 另一个释放(发完响应), 块都在别的线程上归还
+// 每轮之后分别打印两种场景下内存池的命中率, 以及仓库缓存量和进程 RSS.
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_buffer_pool bench/bench_buffer_pool.cc core/buffer_pool.cc core/lock.cc -lpthread
+//     ./bench_buffer_pool [最大线程数=8] [每线程操作数=1000000] [window=256]
+
+#include "bench_util.h"
+#include "buffer_pool.h"
+
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+const int kBatch = 64;
+
+struct Block {
+    void *ptr_;
+    size_t capacity_;
+};
+
+struct PoolAllocator {
+    static Block Alloc(size_t size) {
+        Block b;
+        b.ptr_ = CBufferPool::Alloc(size, &b.capacity_);
+        return b;
+    }
+    static void Grow(Block *b, size_t used, size_t size) {
+        size_t capacity;
+        void *p = CBufferPool::Realloc(b->ptr_, b->capacity_, used, size, &capacity);
+        if (p) {
+            b->ptr_ = p;
+            b->capacity_ = capacity;
+        }
+    }
+    static void Free(Block *b) { CBufferPool::Free(b->ptr_, b->capacity_); }
+};
+
+struct MallocAllocator {
+    static Block Alloc(size_t size) {
+        Block b;
+        b.ptr_ = malloc(size);
+        b.capacity_ = size;
+        return b;
+    }
+    static void Grow(Block *b, size_t used, size_t size) {
+        (void)used;
+        void *p = realloc(b->ptr_, size);
+        if (p) {
+            b->ptr_ = p;
+            b->capacity_ = size;
+        }
+    }
+    static void Free(Block *b) { free(b->ptr_); }
+};
+
+struct Rng {
+    uint64_t s_;
+    explicit Rng(uint64_t seed) : s_(seed * 2654435761ULL + 1) {}
+    uint32_t Next() {
+        s_ ^= s_ << 13;
+        s_ ^= s_ >> 7;
+        s_ ^= s_ << 17;
+        return (uint32_t)s_;
+    }
+    // 256B~128KB, 对数均匀
+    size_t Size() {
+        uint32_t r = Next();
+        int shift = 8 + r % 9;
+        return ((size_t)1 << shift) + (r >> 8) % ((size_t)1 << shift);
+    }
+};
+
+// 申请一个缓冲区, 写开头; 一半写满后扩容到两倍(两边都要拷贝整个旧内容), 再写扩容的部分
+template <class A> Block Make(Rng &rng) {
+    size_t size = rng.Size();
+    Block b = A::Alloc(size);
+    memset(b.ptr_, 1, 64);
+    if (rng.Next() & 1) {
+        A::Grow(&b, size, size * 2);
+        memset((char *)b.ptr_ + size, 2, 64);
+    }
+    return b;
+}
+
+template <class A> void Churn(int id, long ops, long window) {
+    Rng rng(id + 1);
+    std::vector<Block> live(window);
+    for (long i = 0; i < window; i++)
+        live[i] = Make<A>(rng);
+    for (long i = 0; i < ops; i++) {
+        Block &b = live[rng.Next() % window];
+        A::Free(&b);
+        b = Make<A>(rng);
+    }
+    for (long i = 0; i < window; i++)
+        A::Free(&live[i]);
+}
+
+// 一对线程之间按批传递的有界队列
+struct Channel {
+    std::mutex mutex_;
+    std::vector<std::vector<Block> > batches_;
+    bool done_ = false;
+};
+
+template <class A> void Produce(int id, long ops, Channel *ch) {
+    Rng rng(id + 1);
+    for (long i = 0; i < ops; i += kBatch) {
+        std::vector<Block> batch;
+        batch.reserve(kBatch);
+        for (int k = 0; k < kBatch; k++)
+            batch.push_back(Make<A>(rng));
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> guard(ch->mutex_);
+                if (ch->batches_.size() < 16) {
+                    ch->batches_.push_back(std::move(batch));
+                    break;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+    std::lock_guard<std::mutex> guard(ch->mutex_);
+    ch->done_ = true;
+}
+
+template <class A> void Consume(Channel *ch) {
+    for (;;) {
+        std::vector<std::vector<Block> > batches;
+        bool done;
+        {
+            std::lock_guard<std::mutex> guard(ch->mutex_);
+            batches.swap(ch->batches_);
+            done = ch->done_;
+        }
+        for (size_t i = 0; i < batches.size(); i++) {
+            for (size_t k = 0; k < batches[i].size(); k++)
+                A::Free(&batches[i][k]);
+        }
+        if (done && batches.empty())
+            return;
+        if (batches.empty())
+            std::this_thread::yield();
+    }
+}
+
+template <class A> double RunChurn(long threads, long ops, long window) {
+    int64_t start = BenchNowNs();
+    std::vector<std::thread> workers;
+    for (long t = 0; t < threads; t++)
+        workers.emplace_back(Churn<A>, (int)t, ops, window);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    return (double)threads * ops * 1000 / (BenchNowNs() - start);
+}
+
+template <class A> double RunHandoff(long threads, long ops) {
+    long pairs = threads < 2 ? 1 : threads / 2;
+    std::vector<Channel> channels(pairs);
+    int64_t start = BenchNowNs();
+    std::vector<std::thread> workers;
+    for (long p = 0; p < pairs; p++) {
+        workers.emplace_back(Produce<A>, (int)p, ops, &channels[p]);
+        workers.emplace_back(Consume<A>, &channels[p]);
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    return (double)pairs * ops * 1000 / (BenchNowNs() - start);
+}
+
+long RssMb() {
+    long pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+            rss = 0;
+        fclose(fp);
+    }
+    return rss * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+// before 之后这段时间的命中情况, 以及当前的缓存量和 RSS
+void PrintPoolStats(const char *name, const CBufferPool::Stats &before) {
+    CBufferPool::Stats s = CBufferPool::GetStats();
+    double hits = s.hits_ - before.hits_;
+    double depot = s.depot_hits_ - before.depot_hits_;
+    double misses = s.misses_ - before.misses_;
+    double total = hits + depot + misses + (s.oversize_ - before.oversize_);
+    printf("    %-8s hit %5.1f%%, depot %5.1f%%, miss %5.1f%%, depot %.1f MB, rss %ld MB\n", name,
+           100 * hits / total, 100 * depot / total, 100 * misses / total,
+           s.depot_bytes_ / 1048576.0, RssMb());
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    long max_threads = BenchArg(argc, argv, 1, 8);
+    long ops = BenchArg(argc, argv, 2, 1000000);
+    long window = BenchArg(argc, argv, 3, 256);
+
+    printf("hardware threads %u, %ld ops per thread, window %ld, Mops/s\n",
+           std::thread::hardware_concurrency(), ops, window);
+    printf("%8s %10s %10s %12s %10s\n", "threads", "churn pool", "malloc", "handoff pool",
+           "malloc");
+    for (long threads = 1; threads <= max_threads; threads *= 2) {
+        CBufferPool::Stats before = CBufferPool::GetStats();
+        double churn_pool = RunChurn<PoolAllocator>(threads, ops, window);
+        CBufferPool::Stats middle = CBufferPool::GetStats();
+        double churn_malloc = RunChurn<MallocAllocator>(threads, ops, window);
+        double handoff_pool = RunHandoff<PoolAllocator>(threads, ops);
+        double handoff_malloc = RunHandoff<MallocAllocator>(threads, ops);
+        printf("%8ld %10.2f %10.2f %12.2f %10.2f\n", threads, churn_pool, churn_malloc,
+               handoff_pool, handoff_malloc);
+        PrintPoolStats("churn", before);
+        PrintPoolStats("handoff", middle);
+    }
+    CBufferPool::FlushThreadCache();
+    CBufferPool::Trim();
+    printf("after Trim: rss %ld MB\n", RssMb());
+    return 0;
+}
@@ -0,0 +1,141 @@
+// 高并发下阻塞式处理函数和协程处理函数的对比. 每个请求等一次耗时 latency 毫秒的"缓存/数据库"
+// 操作(由一个模拟 IO 线程到期后完成 Promise, 不占工作线程), 然后做一点计算:
+//   blocking:  处理函数在线程池线程上 Get() 等结果, 等待期间线程被占住
+//   coroutine: 处理函数是 Task<void> 协程, co_await 结果时让出线程
+// 同时统计每个请求的堆分配次数(协程帧, Promise 状态等), 恢复协程本身不应再分配.
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_coroutine bench/bench_coroutine.cc core/ih_thread_pool.cc -lpthread
+//     ./bench_coroutine [请求数=5000] [线程数=8] [latency 毫秒=5]
+
+#include "bench_util.h"
+#include "ih_coroutine.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+std::atomic<uint64_t> g_allocs(0);
+
+// 模拟的异步 IO: 请求登记到期时间, 一个后台线程到期后完成对应的 Promise
+class FakeIo {
+  public:
+    FakeIo() : stop_(false), thread_([this] { Loop(); }) {}
+    ~FakeIo() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();
+    }
+
+    Future<int> Query(int latency) {
+        Promise<int> promise;
+        Future<int> future = promise.GetFuture();
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            pending_.emplace(BenchNowNs() + latency * (int64_t)1000000, std::move(promise));
+        }
+        cond_.notify_one();
+        return future;
+    }
+
+  private:
+    void Loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            if (pending_.empty()) {
+                cond_.wait(lock);
+                continue;
+            }
+            int64_t now = BenchNowNs();
+            if (pending_.begin()->first > now) {
+                cond_.wait_for(lock, std::chrono::nanoseconds(pending_.begin()->first - now));
+                continue;
+            }
+            Promise<int> promise = std::move(pending_.begin()->second);
+            pending_.erase(pending_.begin());
+            lock.unlock();
+            promise.SetValue(1);
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::multimap<int64_t, Promise<int> > pending_;
+    bool stop_;
+    std::thread thread_;
+};
+
+void Work(std::atomic<long> *done) {
+    uint64_t x = (uint64_t)done->load(std::memory_order_relaxed);
+    for (int i = 0; i < 256; i++)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    BenchKeep(x);
+    done->fetch_add(1, std::memory_order_relaxed);
+}
+
+void BlockingHandler(FakeIo *io, int latency, std::atomic<long> *done) {
+    io->Query(latency).Get();
+    Work(done);
+}
+
+Task<void> CoroutineHandler(ThreadPool &pool, FakeIo &io, int latency, std::atomic<long> *done) {
+    co_await io.Query(latency);
+    // 结果在 IO 线程上就绪, 回到工作线程池再继续
+    co_await ScheduleOn(pool);
+    Work(done);
+}
+
+template <class Submit> void Run(const char *name, long requests, Submit submit) {
+    std::atomic<long> done(0);
+    uint64_t allocs = g_allocs.load();
+    int64_t start = BenchNowNs();
+    for (long i = 0; i < requests; i++)
+        submit(&done);
+    while (done.load() < requests)
+        usleep(200);
+    int64_t ns = BenchNowNs() - start;
+    printf("%-10s %9.1f ms %10.0f req/s %6.1f allocs/req\n", name, ns / 1e6,
+           requests / (ns / 1e9), (double)(g_allocs.load() - allocs) / requests);
+}
+} // namespace
+
+void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+int main(int argc, char **argv) {
+    long requests = BenchArg(argc, argv, 1, 5000);
+    long threads = BenchArg(argc, argv, 2, 8);
+    int latency = (int)BenchArg(argc, argv, 3, 5);
+
+    ThreadPool pool;
+    pool.Init(threads);
+    pool.EnableStats(false);
+    pool.Start();
+    FakeIo io;
+
+    printf("%ld requests, %ld threads, %d ms per query\n", requests, threads, latency);
+    Run("blocking", requests, [&](std::atomic<long> *done) {
+        pool.Post(BlockingHandler, &io, latency, done);
+    });
+    Run("coroutine", requests, [&](std::atomic<long> *done) {
+        Spawn(pool, CoroutineHandler(pool, io, latency, done));
+    });
+
+    pool.Stop();
+    return 0;
+}
@@ -0,0 +1,215 @@
+// 在图片上传的 multipart body 里找分隔符的速度(MB/s, 按扫描的 body 大小算):
+//   old:      改动前的 MemFind, int 下标逐个位置 memcmp, 原样抄在下面作对照
+//   MemFind:  现在的 MemFind, SIMD 比较首尾字节筛选候选位置
+//   searcher: CMemSearcher, 预先算好跳转表(Horspool)
+//   memmem:   glibc, 对照
+// body 由几个图片字段和一个文本字段组成, 解析时从头依次找出每个分隔符(forward);
+// reverse 从末尾往前依次找出每个分隔符, 对应 MemFind 的 flag = false.
+// 图片默认用伪造的 JPEG 数据(有 0xFF 标记和大段高熵数据), 也可以在命令行给一个真实图片文件.
+// 分隔符测两种长度: 带上前面的 "\r\n--" 后, 浏览器常见的约 40 字节, 以及 70 多字节.
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_memfind bench/bench_memfind.cc core/util.cc core/util_pdu.cc core/lock.cc core/buffer_pool.cc -lpthread
+//     ./bench_memfind [图片文件] [图片个数=3]
+
+#include "bench_util.h"
+#include "util.h"
+
+#include <string.h>
+
+using std::string;
+
+namespace {
+// 基线: 改动前的 MemFind. 正向循环用 i < src_len - sub_len, 查不到紧贴末尾的匹配;
+// body 以 "--\r\n" 结尾, 不影响这里的结果
+const char *OldMemFind(const char *src_str, size_t src_len, const char *sub_str, size_t sub_len,
+                       bool flag) {
+    if (NULL == src_str || NULL == sub_str || src_len <= 0) {
+        return NULL;
+    }
+    if (src_len < sub_len) {
+        return NULL;
+    }
+    const char *p;
+    if (sub_len == 0)
+        sub_len = strlen(sub_str);
+    if (src_len == sub_len) {
+        if (0 == (memcmp(src_str, sub_str, src_len))) {
+            return src_str;
+        } else {
+            return NULL;
+        }
+    }
+    if (flag) {
+        for (int i = 0; i < (int)(src_len - sub_len); i++) {
+            p = src_str + i;
+            if (0 == memcmp(p, sub_str, sub_len))
+                return p;
+        }
+    } else {
+        for (int i = (src_len - sub_len); i >= 0; i--) {
+            p = src_str + i;
+            if (0 == memcmp(p, sub_str, sub_len))
+                return p;
+        }
+    }
+    return NULL;
+}
+
+uint64_t g_seed = 88172645463325252ULL;
+
+uint8_t NextByte() {
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return (uint8_t)g_seed;
+}
+
+// 伪造约 size 字节的 JPEG: SOI, 几个带长度的段, 之后是熵编码数据(0xFF 后面补 0x00)
+string FakeJpeg(size_t size) {
+    string img("\xff\xd8\xff\xe0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00", 20);
+    img += string("\xff\xdb\x00\x43\x00", 5);
+    for (int i = 0; i < 64; i++)
+        img += (char)(1 + i / 4);
+    img += string("\xff\xc0\x00\x11\x08\x0b\xb8\x0f\xa0\x03\x01\x22\x00\x02\x11\x01\x03\x11\x01", 19);
+    img += string("\xff\xda\x00\x0c\x03\x01\x00\x02\x11\x03\x11\x00\x3f\x00", 14);
+    while (img.size() < size) {
+        uint8_t c = NextByte();
+        img += (char)c;
+        if (c == 0xff)
+            img += '\0';
+    }
+    img += "\xff\xd9";
+    return img;
+}
+
+string BuildBody(const string &boundary, const string &image, int images) {
+    string body;
+    for (int i = 0; i < images; i++) {
+        body += "--" + boundary + "\r\n";
+        body += "Content-Disposition: form-data; name=\"file" + std::to_string(i) +
+                "\"; filename=\"IMG_" + std::to_string(1000 + i) + ".jpg\"\r\n";
+        body += "Content-Type: image/jpeg\r\n\r\n";
+        body += image;
+        body += "\r\n";
+    }
+    body += "--" + boundary + "\r\n";
+    body += "Content-Disposition: form-data; name=\"desc\"\r\n\r\n";
+    body += "holiday photos\r\n";
+    body += "--" + boundary + "--\r\n";
+    return body;
+}
+
+template <class Find> double Rate(const string &body, int rounds, size_t expect, Find find) {
+    size_t found = 0;
+    int64_t start = BenchNowNs();
+    for (int r = 0; r < rounds; r++)
+        found += find();
+    int64_t ns = BenchNowNs() - start;
+    if (found != expect * rounds)
+        printf("  found %zu, expect %zu\n", found / rounds, expect);
+    return (double)body.size() * rounds * 1000 / ns;
+}
+
+// 从头依次找出所有分隔符, 返回个数
+template <class Find> size_t ScanAll(const string &body, const string &delim, Find find) {
+    size_t count = 0;
+    const char *pos = body.data();
+    const char *end = body.data() + body.size();
+    while (const char *hit = find(pos, end - pos)) {
+        count++;
+        pos = hit + delim.size();
+    }
+    return count;
+}
+
+// 从末尾往前依次找出所有分隔符
+template <class Find> size_t RScanAll(const string &body, Find find) {
+    size_t count = 0;
+    size_t len = body.size();
+    while (const char *hit = find(body.data(), len)) {
+        count++;
+        len = hit - body.data();
+    }
+    return count;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    string image;
+    if (argc > 1) {
+        FILE *fp = fopen(argv[1], "rb");
+        if (!fp) {
+            printf("open %s failed\n", argv[1]);
+            return 1;
+        }
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            image.append(buf, n);
+        fclose(fp);
+    } else {
+        image = FakeJpeg(3 << 20);
+    }
+    int images = (int)BenchArg(argc, argv, 2, 3);
+
+    const char *boundaries[] = {
+        "----WebKitFormBoundary7MA4YWxkTrZu0gW",
+        "------------------------------a7f3c9e1d2b84f6095e3c1a2b7d4f8e06c3a1b29",
+    };
+    printf("image %zu bytes x %d, MB/s of body\n", image.size(), images);
+    printf("%6s %8s | %8s %8s %8s %8s | %8s %8s %8s\n", "delim", "body MB", "old", "MemFind",
+           "searcher", "memmem", "old rev", "MemFind", "searcher");
+    for (int b = 0; b < 2; b++) {
+        // 查找时带上前面的 CRLF 和 --, 和解析器实际用的一样
+        string delim = string("\r\n--") + boundaries[b];
+        string body = BuildBody(boundaries[b], image, images);
+        size_t parts = ScanAll(body, delim, [&](const char *p, size_t n) {
+            return (const char *)memmem(p, n, delim.data(), delim.size());
+        });
+        int rounds = (int)(1000000000 / body.size()) + 1;
+        CMemSearcher searcher(delim);
+        const char *d = delim.data();
+        size_t m = delim.size();
+
+        double old_fwd = Rate(body, rounds, parts, [&] {
+            return ScanAll(body, delim, [&](const char *p, size_t n) {
+                return OldMemFind(p, n, d, m, true);
+            });
+        });
+        double new_fwd = Rate(body, rounds, parts, [&] {
+            return ScanAll(body, delim, [&](const char *p, size_t n) {
+                return MemFind(p, n, d, m, true);
+            });
+        });
+        double searcher_fwd = Rate(body, rounds, parts, [&] {
+            return ScanAll(body, delim, [&](const char *p, size_t n) {
+                return searcher.Find(p, n);
+            });
+        });
+        double memmem_fwd = Rate(body, rounds, parts, [&] {
+            return ScanAll(body, delim, [&](const char *p, size_t n) {
+                return (const char *)memmem(p, n, d, m);
+            });
+        });
+        double old_rev = Rate(body, rounds, parts, [&] {
+            return RScanAll(body, [&](const char *p, size_t n) {
+                return OldMemFind(p, n, d, m, false);
+            });
+        });
+        double new_rev = Rate(body, rounds, parts, [&] {
+            return RScanAll(body, [&](const char *p, size_t n) {
+                return MemFind(p, n, d, m, false);
+            });
+        });
+        double searcher_rev = Rate(body, rounds, parts, [&] {
+            return RScanAll(body, [&](const char *p, size_t n) {
+                return searcher.RFind(p, n);
+            });
+        });
+        printf("%6zu %8.1f | %8.0f %8.0f %8.0f %8.0f | %8.0f %8.0f %8.0f\n", m,
+               body.size() / 1e6, old_fwd, new_fwd, searcher_fwd, memmem_fwd, old_rev, new_rev,
+               searcher_rev);
+    }
+    return 0;
+}
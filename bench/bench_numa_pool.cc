@@ -0,0 +1,117 @@
+// 访存密集任务在不同线程放置方式下的带宽. 模拟每个连接一块 4MB 缓冲区, 由所在节点的线程
+// 首次写入(内存就落在该节点), 之后的处理任务反复扫描缓冲区:
+//   unpinned: 普通 ThreadPool, 线程不绑核, 任务随便落在哪个节点
+//   pinned:   普通 ThreadPool, 每个线程固定一个 cpu, 但不按缓冲区所在节点分发
+//   numa:     NumaThreadPool, 按 NodeOfAddress(缓冲区) 投递到该节点的线程池
+// 单节点机器上三者应当差不多, 差别要在多路服务器上看.
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_numa_pool bench/bench_numa_pool.cc core/ih_numa_pool.cc core/ih_thread_pool.cc -lpthread
+//     ./bench_numa_pool [每节点线程数=4] [缓冲区个数=64] [扫描轮数=20]
+
+#include "bench_util.h"
+#include "ih_numa_pool.h"
+
+#include <string.h>
+
+namespace {
+const size_t kBufferSize = 4 << 20;
+
+struct Conn {
+    uint64_t *data_;
+    int node_;
+};
+
+// 每次跨 64 字节读一个数, 基本只测内存带宽
+uint64_t Scan(const Conn *conn, int rounds) {
+    uint64_t sum = 0;
+    size_t num = kBufferSize / sizeof(uint64_t);
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < num; i += 8)
+            sum += conn->data_[i];
+    }
+    return sum;
+}
+
+// 每条缓存行都要从内存取一次, 按整个缓冲区的大小算带宽
+void Report(const char *name, int64_t ns, size_t conns, int rounds) {
+    double gb = (double)conns * rounds * kBufferSize / 1e9;
+    printf("%-10s %8.1f ms %8.2f GB/s\n", name, ns / 1e6, gb / (ns / 1e9));
+}
+
+template <class Submit> int64_t RunScan(std::vector<Conn> &conns, int rounds, Submit submit) {
+    std::vector<std::future<uint64_t> > results;
+    int64_t start = BenchNowNs();
+    for (size_t i = 0; i < conns.size(); i++)
+        results.push_back(submit(&conns[i], rounds));
+    uint64_t sum = 0;
+    for (size_t i = 0; i < results.size(); i++)
+        sum += results[i].get();
+    BenchKeep(sum);
+    return BenchNowNs() - start;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    long threads_per_node = BenchArg(argc, argv, 1, 4);
+    long conn_num = BenchArg(argc, argv, 2, 64);
+    int rounds = (int)BenchArg(argc, argv, 3, 20);
+
+    NumaThreadPool numa;
+    numa.Init(threads_per_node, ThreadPool::SHARED_QUEUE, true);
+    numa.Start();
+
+    std::vector<int> node_ids;
+    std::vector<std::vector<int> > node_cpus = NumaThreadPool::GetNodeCpus(&node_ids);
+    std::vector<int> all_cpus;
+    for (size_t i = 0; i < node_cpus.size(); i++)
+        all_cpus.insert(all_cpus.end(), node_cpus[i].begin(), node_cpus[i].end());
+    if (node_ids.empty())
+        node_ids.push_back(0);
+
+    // 缓冲区轮流在各节点的线程上分配并写满, 按首次写入落到该节点
+    std::vector<Conn> conns(conn_num);
+    for (size_t i = 0; i < conns.size(); i++) {
+        int node = node_ids[i % node_ids.size()];
+        conns[i].data_ = numa.Exec(node, [] {
+            uint64_t *data = (uint64_t *)malloc(kBufferSize);
+            memset(data, 1, kBufferSize);
+            return data;
+        }).get();
+        conns[i].node_ = NumaThreadPool::NodeOfAddress(conns[i].data_);
+    }
+
+    size_t threads = threads_per_node * numa.GetNodeNum();
+    printf("nodes %zu, %zu threads, %ld buffers of %zu MB, %d rounds\n", numa.GetNodeNum(),
+           threads, conn_num, kBufferSize >> 20, rounds);
+
+    ThreadPool unpinned;
+    unpinned.Init(threads);
+    unpinned.Start();
+
+    ThreadPool pinned;
+    pinned.Init(threads);
+    if (!all_cpus.empty())
+        pinned.SetAffinity(all_cpus, true);
+    pinned.Start();
+
+    // 先扫一遍预热, 排除缺页和 TLB 的影响; NodeOfAddress 取不到时 -1 会落到当前节点
+    RunScan(conns, 1, [&](Conn *c, int r) { return unpinned.Exec(Scan, c, r); });
+
+    Report("unpinned", RunScan(conns, rounds, [&](Conn *c, int r) {
+        return unpinned.Exec(Scan, c, r);
+    }), conns.size(), rounds);
+    Report("pinned", RunScan(conns, rounds, [&](Conn *c, int r) {
+        return pinned.Exec(Scan, c, r);
+    }), conns.size(), rounds);
+    Report("numa", RunScan(conns, rounds, [&](Conn *c, int r) {
+        return numa.Exec(c->node_, Scan, c, r);
+    }), conns.size(), rounds);
+
+    unpinned.Stop();
+    pinned.Stop();
+    numa.Stop();
+    for (size_t i = 0; i < conns.size(); i++)
+        free(conns[i].data_);
+    return 0;
+}
@@ -0,0 +1,107 @@
+// 一次 AddRef/ReleaseRef 的开销:
+//   locked:    原来的 CRefObject 实现(SetLock 设了 CLock 时每次增减都加锁), 原样抄在下面作对照
+//   atomic:    现在的 CRefObject, 原子计数
+//   intrusive: 拷贝再析构一个 IntrusivePtr<CRefObject>, 即 AddRef + ReleaseRef
+// 单线程只看指令开销; 跨线程时所有线程对同一个对象增减, 缓存行来回迁移, 接近连接对象在
+// 多个工作线程之间传递的情况.
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_refcount bench/bench_refcount.cc core/util.cc core/util_pdu.cc core/lock.cc core/buffer_pool.cc -lpthread
+//     ./bench_refcount [最大线程数=8] [每线程增减次数=2000000]
+
+#include "bench_util.h"
+#include "util.h"
+
+#include <thread>
+
+namespace {
+// 基线: 改动前的 CRefObject, 计数用外部的 CLock 保护. 放到 noinline 函数里, 和原来一样是
+// util.cc 里的普通函数调用
+class OldRefObject {
+  public:
+    OldRefObject() : ref_count_(1), lock_(NULL) {}
+    virtual ~OldRefObject() {}
+
+    void SetLock(CLock *lock) { lock_ = lock; }
+    __attribute__((noinline)) void AddRef() {
+        if (lock_) {
+            lock_->lock();
+            ref_count_++;
+            lock_->unlock();
+        } else {
+            ref_count_++;
+        }
+    }
+    // 原实现计数减到 0 时 delete 后直接返回, 锁没有释放; 压测里计数不会到 0
+    __attribute__((noinline)) void ReleaseRef() {
+        if (lock_) {
+            lock_->lock();
+            ref_count_--;
+            if (ref_count_ == 0) {
+                delete this;
+                return;
+            }
+            lock_->unlock();
+        } else {
+            ref_count_--;
+            if (ref_count_ == 0)
+                delete this;
+        }
+    }
+
+  private:
+    int ref_count_;
+    CLock *lock_;
+};
+
+template <class Op> double Run(long threads, long iters, Op op) {
+    int64_t start = BenchNowNs();
+    std::vector<std::thread> workers;
+    for (long t = 0; t < threads; t++) {
+        workers.emplace_back([iters, &op] {
+            for (long i = 0; i < iters; i++)
+                op();
+        });
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    return (double)(BenchNowNs() - start) / (threads * iters);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    long max_threads = BenchArg(argc, argv, 1, 8);
+    long iters = BenchArg(argc, argv, 2, 2000000);
+
+    CLock lock;
+    OldRefObject *old_obj = new OldRefObject();
+    old_obj->SetLock(&lock);
+    IntrusivePtr<CRefObject> obj = MakeIntrusive<CRefObject>();
+
+    printf("hardware threads %u, %ld pairs per thread, ns per AddRef/ReleaseRef pair\n",
+           std::thread::hardware_concurrency(), iters);
+    printf("%8s %10s %10s %10s\n", "threads", "locked", "atomic", "intrusive");
+    for (long threads = 1; threads <= max_threads; threads *= 2) {
+        double locked_ns = Run(threads, iters, [old_obj] {
+            old_obj->AddRef();
+            old_obj->ReleaseRef();
+        });
+        CRefObject *raw = obj.get();
+        double atomic_ns = Run(threads, iters, [raw] {
+            raw->AddRef();
+            raw->ReleaseRef();
+        });
+        double intrusive_ns = Run(threads, iters, [&obj] {
+            IntrusivePtr<CRefObject> copy = obj;
+            BenchKeep(copy.get());
+        });
+        printf("%8ld %10.1f %10.1f %10.1f\n", threads, locked_ns, atomic_ns, intrusive_ns);
+    }
+
+    if (obj->GetRefCount() != 1)
+        printf("bad ref count %d\n", obj->GetRefCount());
+    // 避开原实现 delete 后不解锁的问题
+    old_obj->SetLock(NULL);
+    old_obj->ReleaseRef();
+    return 0;
+}
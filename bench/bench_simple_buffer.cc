@@ -0,0 +1,149 @@
+// CSimpleBuffer 分小块读出一个大请求体的耗时:
+//   old:     改动前的实现, 每次 Read 都把剩下的数据 memmove 到开头, 原样抄在下面作对照
+//   read:    现在的 Read, 只移动读偏移
+//   consume: 现在的 Peek + Consume, 不拷贝(直接交给处理函数)
+// 两种场景:
+//   drain:  整个上传体(默认 10MB)先收齐, 再按 4KB 读出, 旧实现是 O(n^2) 的拷贝
+//   stream: 每收到 64KB 就尽量按 4KB 读出, 缓冲区一直不大, 看日常情况下有没有变慢
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_simple_buffer bench/bench_simple_buffer.cc core/util_pdu.cc core/buffer_pool.cc core/lock.cc -lpthread
+//     ./bench_simple_buffer [请求体 MB=10] [每次读的字节数=4096]
+
+#include "bench_util.h"
+#include "util_pdu.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+const uint32_t kRecvSize = 64 * 1024;
+
+// 基线: 改动前的 CSimpleBuffer
+class OldSimpleBuffer {
+  public:
+    OldSimpleBuffer() : buf_(NULL), alloc_size_(0), write_offset_(0) {}
+    ~OldSimpleBuffer() { free(buf_); }
+
+    void Extend(uint32_t len) {
+        alloc_size_ = write_offset_ + len;
+        alloc_size_ += alloc_size_ >> 2; // increase by 1/4 allocate size
+        uchar_t *new_buf = (uchar_t *)realloc(buf_, alloc_size_);
+        buf_ = new_buf;
+    }
+
+    uint32_t Write(void *buf, uint32_t len) {
+        if (write_offset_ + len > alloc_size_) {
+            Extend(len);
+        }
+        if (buf) {
+            memcpy(buf_ + write_offset_, buf, len);
+        }
+        write_offset_ += len;
+        return len;
+    }
+
+    uint32_t Read(void *buf, uint32_t len) {
+        if (0 == len)
+            return len;
+        if (len > write_offset_)
+            len = write_offset_;
+        if (buf)
+            memcpy(buf, buf_, len);
+        write_offset_ -= len;
+        memmove(buf_, buf_ + len, write_offset_);
+        return len;
+    }
+
+  private:
+    uchar_t *buf_;
+    uint32_t alloc_size_;
+    uint32_t write_offset_;
+};
+
+// 模拟处理函数消费一块数据
+inline uint64_t Handle(const uchar_t *data, uint32_t len, uint64_t sum) {
+    return sum + data[0] + data[len - 1] + len;
+}
+
+// 返回毫秒; read_one 从 buf 取最多 piece 字节交给 Handle, 返回取到的字节数
+template <class Buffer, class ReadOne>
+double Drain(const std::vector<uchar_t> &body, uint32_t piece, ReadOne read_one) {
+    int64_t start = BenchNowNs();
+    Buffer buf;
+    buf.Write((void *)body.data(), (uint32_t)body.size());
+    uint64_t sum = 0;
+    while (read_one(buf, piece, &sum) > 0) {
+    }
+    BenchKeep(sum);
+    return (BenchNowNs() - start) / 1e6;
+}
+
+template <class Buffer, class ReadOne>
+double Stream(const std::vector<uchar_t> &body, uint32_t piece, ReadOne read_one) {
+    int64_t start = BenchNowNs();
+    Buffer buf;
+    uint64_t sum = 0;
+    size_t received = 0;
+    size_t handled = 0;
+    while (handled < body.size()) {
+        if (received < body.size()) {
+            uint32_t n = (uint32_t)std::min<size_t>(kRecvSize, body.size() - received);
+            buf.Write((void *)(body.data() + received), n);
+            received += n;
+        }
+        // 不满一块的留到下次收到数据再处理, 最后一块除外
+        size_t pending = received - handled;
+        while (pending >= piece || (received == body.size() && pending > 0)) {
+            uint32_t n = read_one(buf, piece, &sum);
+            handled += n;
+            pending -= n;
+        }
+    }
+    BenchKeep(sum);
+    return (BenchNowNs() - start) / 1e6;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    long body_mb = BenchArg(argc, argv, 1, 10);
+    uint32_t piece = (uint32_t)BenchArg(argc, argv, 2, 4096);
+
+    std::vector<uchar_t> body(body_mb << 20);
+    for (size_t i = 0; i < body.size(); i++)
+        body[i] = (uchar_t)(i * 131);
+    std::vector<uchar_t> out(piece);
+
+    auto old_read = [&out](OldSimpleBuffer &buf, uint32_t len, uint64_t *sum) {
+        uint32_t n = buf.Read(out.data(), len);
+        if (n > 0)
+            *sum = Handle(out.data(), n, *sum);
+        return n;
+    };
+    auto new_read = [&out](CSimpleBuffer &buf, uint32_t len, uint64_t *sum) {
+        uint32_t n = buf.Read(out.data(), len);
+        if (n > 0)
+            *sum = Handle(out.data(), n, *sum);
+        return n;
+    };
+    auto new_consume = [](CSimpleBuffer &buf, uint32_t len, uint64_t *sum) {
+        uint32_t avail;
+        uchar_t *data = buf.Peek(avail);
+        uint32_t n = std::min(avail, len);
+        if (n > 0) {
+            *sum = Handle(data, n, *sum);
+            buf.Consume(n);
+        }
+        return n;
+    };
+
+    printf("%ld MB body, %u byte pieces, ms\n", body_mb, piece);
+    printf("%-8s %10s %10s %10s\n", "", "old", "read", "consume");
+    printf("%-8s %10.2f %10.2f %10.2f\n", "drain", Drain<OldSimpleBuffer>(body, piece, old_read),
+           Drain<CSimpleBuffer>(body, piece, new_read),
+           Drain<CSimpleBuffer>(body, piece, new_consume));
+    printf("%-8s %10.2f %10.2f %10.2f\n", "stream", Stream<OldSimpleBuffer>(body, piece, old_read),
+           Stream<CSimpleBuffer>(body, piece, new_read),
+           Stream<CSimpleBuffer>(body, piece, new_consume));
+    return 0;
+}
@@ -0,0 +1,73 @@
+// ThreadPool 调度模式对比: 共享队列(SHARED_QUEUE) 和工作窃取(WORK_STEALING) 在
+// 1 到 64 个线程下的吞吐.
+//   external: 所有任务都由主线程提交
+//   fan-out:  主线程提交父任务, 每个父任务在工作线程里再提交 16 个子任务(上传拆分缩略图这类场景)
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_thread_pool bench/bench_thread_pool.cc core/ih_thread_pool.cc -lpthread
+//     ./bench_thread_pool [最大线程数=64] [任务数=400000]
+
+#include "bench_util.h"
+#include "ih_thread_pool.h"
+
+namespace {
+const int kChildren = 16;
+
+// 每个任务约几百纳秒的计算, 调度开销占大头, 能看出队列的差别
+void Work(std::atomic<uint64_t> *sum, uint64_t seed) {
+    uint64_t x = seed;
+    for (int i = 0; i < 64; i++)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    sum->fetch_add(x & 1, std::memory_order_relaxed);
+}
+
+double RunExternal(ThreadPool &pool, long tasks, std::atomic<uint64_t> *sum) {
+    int64_t start = BenchNowNs();
+    for (long i = 0; i < tasks; i++)
+        pool.Post(Work, sum, (uint64_t)i);
+    pool.WaitForAllDone();
+    return (double)tasks * 1000 / (BenchNowNs() - start);
+}
+
+double RunFanOut(ThreadPool &pool, long tasks, std::atomic<uint64_t> *sum) {
+    long parents = tasks / (kChildren + 1);
+    int64_t start = BenchNowNs();
+    for (long i = 0; i < parents; i++) {
+        pool.Post([&pool, sum, i] {
+            for (int k = 0; k < kChildren; k++)
+                pool.Post(Work, sum, (uint64_t)(i * kChildren + k));
+            Work(sum, (uint64_t)i);
+        });
+    }
+    pool.WaitForAllDone();
+    return (double)parents * (kChildren + 1) * 1000 / (BenchNowNs() - start);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    long max_threads = BenchArg(argc, argv, 1, 64);
+    long tasks = BenchArg(argc, argv, 2, 400000);
+
+    printf("hardware threads %u, %ld tasks per run, Mtask/s\n",
+           std::thread::hardware_concurrency(), tasks);
+    printf("%8s %12s %12s %12s %12s\n", "threads", "ext shared", "ext steal", "fan shared",
+           "fan steal");
+
+    for (long threads = 1; threads <= max_threads; threads *= 2) {
+        double result[2][2];
+        for (int mode = 0; mode < 2; mode++) {
+            ThreadPool pool;
+            pool.Init(threads, mode == 0 ? ThreadPool::SHARED_QUEUE : ThreadPool::WORK_STEALING);
+            pool.EnableStats(false);
+            pool.Start();
+            std::atomic<uint64_t> sum(0);
+            result[0][mode] = RunExternal(pool, tasks, &sum);
+            result[1][mode] = RunFanOut(pool, tasks, &sum);
+            pool.Stop();
+            BenchKeep(sum.load());
+        }
+        printf("%8ld %12.2f %12.2f %12.2f %12.2f\n", threads, result[0][0], result[0][1],
+               result[1][0], result[1][1]);
+    }
+    return 0;
+}
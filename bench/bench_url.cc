@@ -0,0 +1,125 @@
+// URLEncode / URLDecode 的吞吐(按输入字节算 MB/s):
+//   old:    改动前的实现, 逐字节 isalnum 判断, 经 4 字节临时缓冲 out += 追加, 原样抄在下面作对照
+//   string: 现在返回 std::string 的版本
+//   buffer: 现在写入调用方缓冲区的版本, 缓冲区复用, 没有分配
+// 输入三种: 英文文件名/查询串(大部分字节不用转义), 中文文件名(UTF-8, 全部要转义), 两者混合;
+// 长度分短(约 64 字节, 典型文件名)和长(4KB, 长查询串)两档.
+//
+// 在仓库根目录编译运行:
+//     g++ -std=c++20 -O2 -Icore -o bench_url bench/bench_url.cc core/util.cc core/util_pdu.cc core/lock.cc core/buffer_pool.cc -lpthread
+//     ./bench_url [总输入 MB=200]
+
+#include "bench_util.h"
+#include "util.h"
+
+#include <ctype.h>
+
+using std::string;
+
+namespace {
+// 基线: 改动前的 URLEncode / URLDecode
+inline unsigned char OldToHex(const unsigned char &x) { return x > 9 ? x - 10 + 'A' : x + '0'; }
+
+inline unsigned char OldFromHex(const unsigned char &x) {
+    return isdigit(x) ? x - '0' : x - 'A' + 10;
+}
+
+string OldURLEncode(const string &in) {
+    string out;
+    for (size_t ix = 0; ix < in.size(); ix++) {
+        unsigned char buf[4];
+        memset(buf, 0, 4);
+        if (isalnum((unsigned char)in[ix])) {
+            buf[0] = in[ix];
+        } else {
+            buf[0] = '%';
+            buf[1] = OldToHex((unsigned char)in[ix] >> 4);
+            buf[2] = OldToHex((unsigned char)in[ix] % 16);
+        }
+        out += (char *)buf;
+    }
+    return out;
+}
+
+string OldURLDecode(const string &in) {
+    string out;
+    for (size_t ix = 0; ix < in.size(); ix++) {
+        unsigned char ch = 0;
+        if (in[ix] == '%') {
+            ch = (OldFromHex(in[ix + 1]) << 4);
+            ch |= OldFromHex(in[ix + 2]);
+            ix += 2;
+        } else if (in[ix] == '+') {
+            ch = ' ';
+        } else {
+            ch = in[ix];
+        }
+        out += (char)ch;
+    }
+    return out;
+}
+
+string MakeInput(int kind, size_t len) {
+    static const char *kAscii = "IMG_20240315_142233_holiday-photos/beach_sunset";
+    static const char *kChinese = "\xe5\x81\x87\xe6\x9c\x9f\xe7\x85\xa7\xe7\x89\x87"; // 假期照片
+    string out;
+    while (out.size() < len) {
+        if (kind == 0 || (kind == 2 && out.size() % 96 < 48))
+            out += kAscii;
+        else
+            out += kChinese;
+        out += (kind == 0 && out.size() % 3 == 0) ? "&q=" : ".jpg";
+    }
+    out.resize(len);
+    return out;
+}
+
+template <class F> double Rate(size_t len, long rounds, F f) {
+    size_t total = 0;
+    int64_t start = BenchNowNs();
+    for (long r = 0; r < rounds; r++)
+        total += f();
+    int64_t ns = BenchNowNs() - start;
+    BenchKeep(total);
+    return (double)len * rounds * 1000 / ns;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    long total_mb = BenchArg(argc, argv, 1, 200);
+    const char *kinds[] = {"ascii", "chinese", "mixed"};
+    const size_t lens[] = {64, 4096};
+
+    printf("MB/s of input\n");
+    printf("%-8s %6s | %8s %8s %8s | %8s %8s %8s\n", "input", "len", "enc old", "string",
+           "buffer", "dec old", "string", "buffer");
+    for (int kind = 0; kind < 3; kind++) {
+        for (int l = 0; l < 2; l++) {
+            size_t len = lens[l];
+            long rounds = total_mb * 1000000 / len;
+            string in = MakeInput(kind, len);
+            string enc = URLEncode(in);
+            if (enc != OldURLEncode(in) || URLDecode(enc) != OldURLDecode(enc)) {
+                printf("mismatch on %s/%zu\n", kinds[kind], len);
+                return 1;
+            }
+            std::vector<char> buf(3 * len);
+
+            double enc_old = Rate(len, rounds, [&] { return OldURLEncode(in).size(); });
+            double enc_str = Rate(len, rounds, [&] { return URLEncode(in).size(); });
+            double enc_buf = Rate(len, rounds, [&] {
+                return (size_t)URLEncode(in.data(), in.size(), buf.data(), buf.size());
+            });
+            // 解码按编码后的长度算
+            long dec_rounds = total_mb * 1000000 / enc.size();
+            double dec_old = Rate(enc.size(), dec_rounds, [&] { return OldURLDecode(enc).size(); });
+            double dec_str = Rate(enc.size(), dec_rounds, [&] { return URLDecode(enc).size(); });
+            double dec_buf = Rate(enc.size(), dec_rounds, [&] {
+                return (size_t)URLDecode(enc.data(), enc.size(), buf.data(), buf.size());
+            });
+            printf("%-8s %6zu | %8.0f %8.0f %8.0f | %8.0f %8.0f %8.0f\n", kinds[kind], len,
+                   enc_old, enc_str, enc_buf, dec_old, dec_str, dec_buf);
+        }
+    }
+    return 0;
+}
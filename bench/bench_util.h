@@ -0,0 +1,30 @@
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+// bench/ 下各个独立压测程序共用的小工具. 程序之间没有依赖, 每个文件开头写了在仓库根目录
+// 下的编译命令; 测性能时不要加 -fsanitize, 至少 -O2.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+inline int64_t BenchNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+}
+
+// 让编译器认为 value 被用到了, 被测代码不会整个被优化掉
+template <class T> inline void BenchKeep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 第 index 个命令行参数转成整数, 没有时返回 def
+inline long BenchArg(int argc, char **argv, int index, long def) {
+    if (index < argc)
+        return strtol(argv[index], NULL, 10);
+    return def;
+}
+
+#endif
@@ -0,0 +1,353 @@
+#include "buffer_pool.h"
+#include "lock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+struct FreeNode {
+    FreeNode *next_;
+};
+
+struct FreeList {
+    FreeNode *head_;
+    uint32_t count_;
+
+    void Push(FreeNode *node) {
+        node->next_ = head_;
+        head_ = node;
+        count_++;
+    }
+
+    FreeNode *Pop() {
+        FreeNode *node = head_;
+        if (node != NULL) {
+            head_ = node->next_;
+            count_--;
+        }
+        return node;
+    }
+};
+
+// size 所在的级别, 超过最大级别返回 -1
+inline int SizeClass(size_t size) {
+    if (size <= ((size_t)1 << CBufferPool::kMinShift))
+        return 0;
+    if (size > ((size_t)1 << CBufferPool::kMaxShift))
+        return -1;
+    return 64 - __builtin_clzll(size - 1) - CBufferPool::kMinShift;
+}
+
+inline size_t ClassSize(int c) { return (size_t)1 << (c + CBufferPool::kMinShift); }
+
+// 每个线程每级最多缓存的块数: 每级约 256KB, 至多 64 块; 至少 2 块, 一块就超过 256KB 的大级别会超出
+inline uint32_t ThreadLimit(int c) {
+    size_t num = ((size_t)256 * 1024) >> (c + CBufferPool::kMinShift);
+    if (num < 2)
+        return 2;
+    return num > 64 ? 64 : (uint32_t)num;
+}
+
+// 仓库每级最多约 2MB, 小块最多 16 个线程链表的量, 大块至少能放下一个线程链表
+inline uint32_t DepotLimit(int c) {
+    uint32_t num = (uint32_t)(((size_t)2 * 1024 * 1024) >> (c + CBufferPool::kMinShift));
+    if (num > ThreadLimit(c) * 16)
+        return ThreadLimit(c) * 16;
+    return num < ThreadLimit(c) ? ThreadLimit(c) : num;
+}
+
+// 只有一个线程写的计数, 其他线程统计时读; 共享的计数用 fetch_add
+template <class T> inline void AddCounter(std::atomic<T> &counter, T value, bool shared) {
+    if (shared)
+        counter.fetch_add(value, std::memory_order_relaxed);
+    else
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct Counters {
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> depot_hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> oversize_;
+    std::atomic<int64_t> in_use_bytes_;
+    std::atomic<uint64_t> cached_bytes_;
+
+    Counters() : hits_(0), depot_hits_(0), misses_(0), oversize_(0), in_use_bytes_(0), cached_bytes_(0) {}
+};
+
+struct ThreadCache {
+    FreeList lists_[CBufferPool::kClassNum];
+    Counters counters_;
+};
+
+// 全局仓库和线程登记表都不析构, 其他线程退出时可能还在用
+struct Depot {
+    CAdaptiveLock lock_;
+    FreeList lists_[CBufferPool::kClassNum];
+    std::atomic<uint64_t> bytes_;
+    // 已退出线程的计数, 以及线程缓存析构后的分配释放
+    Counters retired_;
+
+    std::mutex registry_mutex_;
+    std::vector<ThreadCache *> caches_;
+
+    Depot() : bytes_(0) { memset(lists_, 0, sizeof(lists_)); }
+};
+
+Depot &GetDepot() {
+    static Depot *depot = new Depot();
+    return *depot;
+}
+
+// 从仓库取最多 num 块放进 list, 返回取到的块数
+uint32_t DepotPop(int c, FreeList &list, uint32_t num) {
+    Depot &depot = GetDepot();
+    uint32_t got = 0;
+    CAutoLock lock(&depot.lock_);
+    while (got < num) {
+        FreeNode *node = depot.lists_[c].Pop();
+        if (node == NULL)
+            break;
+        list.Push(node);
+        got++;
+    }
+    depot.bytes_.fetch_sub(got * ClassSize(c), std::memory_order_relaxed);
+    return got;
+}
+
+// list 里的块还给仓库, 仓库满了的部分 free
+void DepotPush(int c, FreeList &list, uint32_t num) {
+    Depot &depot = GetDepot();
+    FreeList overflow = {NULL, 0};
+    {
+        CAutoLock lock(&depot.lock_);
+        uint32_t pushed = 0;
+        while (num-- > 0) {
+            FreeNode *node = list.Pop();
+            if (node == NULL)
+                break;
+            if (depot.lists_[c].count_ < DepotLimit(c)) {
+                depot.lists_[c].Push(node);
+                pushed++;
+            } else {
+                overflow.Push(node);
+            }
+        }
+        depot.bytes_.fetch_add(pushed * ClassSize(c), std::memory_order_relaxed);
+    }
+
+    while (FreeNode *node = overflow.Pop())
+        free(node);
+}
+
+void FlushCache(ThreadCache *cache) {
+    for (int c = 0; c < CBufferPool::kClassNum; c++) {
+        FreeList &list = cache->lists_[c];
+        AddCounter<uint64_t>(cache->counters_.cached_bytes_, -(uint64_t)(list.count_ * ClassSize(c)),
+                             false);
+        DepotPush(c, list, list.count_);
+    }
+}
+
+thread_local ThreadCache *tls_cache = NULL;
+thread_local bool tls_cache_dead = false;
+
+// 线程退出时归还缓存的块, 计数并入 retired_. 之后本线程的分配释放直接走仓库
+class ThreadCacheHolder {
+  public:
+    ThreadCacheHolder() {
+        memset(cache_.lists_, 0, sizeof(cache_.lists_));
+        Depot &depot = GetDepot();
+        std::lock_guard<std::mutex> lock(depot.registry_mutex_);
+        depot.caches_.push_back(&cache_);
+        tls_cache = &cache_;
+    }
+
+    ~ThreadCacheHolder() {
+        FlushCache(&cache_);
+        Depot &depot = GetDepot();
+        std::lock_guard<std::mutex> lock(depot.registry_mutex_);
+        for (size_t i = 0; i < depot.caches_.size(); i++) {
+            if (depot.caches_[i] == &cache_) {
+                depot.caches_[i] = depot.caches_.back();
+                depot.caches_.pop_back();
+                break;
+            }
+        }
+
+        Counters &from = cache_.counters_;
+        Counters &to = depot.retired_;
+        AddCounter(to.hits_, from.hits_.load(std::memory_order_relaxed), true);
+        AddCounter(to.depot_hits_, from.depot_hits_.load(std::memory_order_relaxed), true);
+        AddCounter(to.misses_, from.misses_.load(std::memory_order_relaxed), true);
+        AddCounter(to.oversize_, from.oversize_.load(std::memory_order_relaxed), true);
+        AddCounter(to.in_use_bytes_, from.in_use_bytes_.load(std::memory_order_relaxed), true);
+        tls_cache = NULL;
+        tls_cache_dead = true;
+    }
+
+  private:
+    ThreadCache cache_;
+};
+
+ThreadCache *GetThreadCache() {
+    if (tls_cache == NULL && !tls_cache_dead) {
+        static thread_local ThreadCacheHolder holder;
+    }
+    return tls_cache;
+}
+
+Counters &GetCounters(ThreadCache *cache) {
+    return cache != NULL ? cache->counters_ : GetDepot().retired_;
+}
+} // namespace
+
+void *CBufferPool::Alloc(size_t size, size_t *capacity) {
+    ThreadCache *cache = GetThreadCache();
+    Counters &counters = GetCounters(cache);
+    bool shared = cache == NULL;
+
+    int c = SizeClass(size);
+    if (c < 0) {
+        void *ptr = malloc(size);
+        if (ptr == NULL)
+            return NULL;
+        AddCounter<uint64_t>(counters.oversize_, 1, shared);
+        AddCounter<int64_t>(counters.in_use_bytes_, size, shared);
+        *capacity = size;
+        return ptr;
+    }
+
+    size_t bytes = ClassSize(c);
+    *capacity = bytes;
+    if (cache != NULL) {
+        FreeList &list = cache->lists_[c];
+        if (list.count_ > 0) {
+            AddCounter<uint64_t>(counters.hits_, 1, false);
+            AddCounter<uint64_t>(counters.cached_bytes_, -(uint64_t)bytes, false);
+        } else if (DepotPop(c, list, ThreadLimit(c) / 2) > 0) {
+            // 一次取半个链表, 下一次分配直接命中
+            AddCounter<uint64_t>(counters.depot_hits_, 1, false);
+            AddCounter<uint64_t>(counters.cached_bytes_, (list.count_ - 1) * bytes, false);
+        }
+
+        FreeNode *node = list.Pop();
+        if (node != NULL) {
+            AddCounter<int64_t>(counters.in_use_bytes_, bytes, false);
+            return node;
+        }
+    } else {
+        FreeList list = {NULL, 0};
+        if (DepotPop(c, list, 1) > 0) {
+            AddCounter<uint64_t>(counters.depot_hits_, 1, true);
+            AddCounter<int64_t>(counters.in_use_bytes_, bytes, true);
+            return list.Pop();
+        }
+    }
+
+    void *ptr = malloc(bytes);
+    if (ptr == NULL)
+        return NULL;
+    AddCounter<uint64_t>(counters.misses_, 1, shared);
+    AddCounter<int64_t>(counters.in_use_bytes_, bytes, shared);
+    return ptr;
+}
+
+void CBufferPool::Free(void *ptr, size_t capacity) {
+    if (ptr == NULL)
+        return;
+
+    ThreadCache *cache = GetThreadCache();
+    Counters &counters = GetCounters(cache);
+    bool shared = cache == NULL;
+    AddCounter<int64_t>(counters.in_use_bytes_, -(int64_t)capacity, shared);
+
+    int c = SizeClass(capacity);
+    if (c < 0) {
+        free(ptr);
+        return;
+    }
+
+    FreeNode *node = (FreeNode *)ptr;
+    if (cache == NULL) {
+        FreeList list = {NULL, 0};
+        list.Push(node);
+        DepotPush(c, list, 1);
+        return;
+    }
+
+    FreeList &list = cache->lists_[c];
+    list.Push(node);
+    AddCounter<uint64_t>(counters.cached_bytes_, capacity, false);
+    if (list.count_ > ThreadLimit(c)) {
+        uint32_t num = list.count_ / 2;
+        AddCounter<uint64_t>(counters.cached_bytes_, -(uint64_t)(num * capacity), false);
+        DepotPush(c, list, num);
+    }
+}
+
+void *CBufferPool::Realloc(void *ptr, size_t capacity, size_t used, size_t size,
+                           size_t *new_capacity) {
+    if (ptr != NULL && SizeClass(capacity) < 0 && SizeClass(size) < 0) {
+        void *new_ptr = realloc(ptr, size);
+        if (new_ptr == NULL)
+            return NULL;
+        ThreadCache *cache = GetThreadCache();
+        AddCounter<uint64_t>(GetCounters(cache).oversize_, 1, cache == NULL);
+        AddCounter<int64_t>(GetCounters(cache).in_use_bytes_, (int64_t)size - (int64_t)capacity,
+                            cache == NULL);
+        *new_capacity = size;
+        return new_ptr;
+    }
+
+    void *new_ptr = Alloc(size, new_capacity);
+    if (new_ptr == NULL)
+        return NULL;
+    if (ptr != NULL) {
+        memcpy(new_ptr, ptr, used);
+        Free(ptr, capacity);
+    }
+    return new_ptr;
+}
+
+CBufferPool::Stats CBufferPool::GetStats() {
+    Depot &depot = GetDepot();
+    Stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    std::lock_guard<std::mutex> lock(depot.registry_mutex_);
+    for (size_t i = 0; i <= depot.caches_.size(); i++) {
+        Counters &counters = i < depot.caches_.size() ? depot.caches_[i]->counters_ : depot.retired_;
+        stats.hits_ += counters.hits_.load(std::memory_order_relaxed);
+        stats.depot_hits_ += counters.depot_hits_.load(std::memory_order_relaxed);
+        stats.misses_ += counters.misses_.load(std::memory_order_relaxed);
+        stats.oversize_ += counters.oversize_.load(std::memory_order_relaxed);
+        stats.in_use_bytes_ += counters.in_use_bytes_.load(std::memory_order_relaxed);
+        stats.thread_cached_bytes_ += counters.cached_bytes_.load(std::memory_order_relaxed);
+    }
+    stats.depot_bytes_ = depot.bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CBufferPool::FlushThreadCache() {
+    ThreadCache *cache = GetThreadCache();
+    if (cache != NULL)
+        FlushCache(cache);
+}
+
+void CBufferPool::Trim() {
+    Depot &depot = GetDepot();
+    for (int c = 0; c < kClassNum; c++) {
+        FreeList list = {NULL, 0};
+        {
+            CAutoLock lock(&depot.lock_);
+            list = depot.lists_[c];
+            depot.lists_[c].head_ = NULL;
+            depot.lists_[c].count_ = 0;
+            depot.bytes_.fetch_sub(list.count_ * ClassSize(c), std::memory_order_relaxed);
+        }
+
+        while (FreeNode *node = list.Pop())
+            free(node);
+    }
+}
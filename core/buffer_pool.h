@@ -0,0 +1,44 @@
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 按大小分级的缓冲区内存池, 给 CSimpleBuffer 这类频繁申请释放的缓冲区用.
+// 256B 到 1MB 按 2 的幂分 13 级, 每个线程每级有一个空闲链表, 命中时不加锁;
+// 本线程的链表满了把一半还给全局仓库, 空了先从仓库批量取, 仓库也没有才 malloc.
+// 线程链表每级约 256KB, 但至少 2 块, 所以 256KB/512KB/1MB 三级每线程分别最多缓存
+// 512KB/1MB/2MB, 一个线程合计最多约 5.2MB.
+// 仓库每级也有上限(约 2MB), 超出的直接 free, 空闲内存不会无限增长. 超过 1MB 的直接走 malloc.
+// 释放时必须带上申请时返回的 capacity. 线程退出时本线程缓存的块归还仓库
+class CBufferPool {
+  public:
+    static const int kMinShift = 8;
+    static const int kMaxShift = 20;
+    static const int kClassNum = kMaxShift - kMinShift + 1;
+
+    struct Stats {
+        uint64_t hits_;         // 线程缓存命中
+        uint64_t depot_hits_;   // 从全局仓库取到
+        uint64_t misses_;       // 分级内 malloc 的次数
+        uint64_t oversize_;     // 超过最大级别直接 malloc 的次数
+        int64_t in_use_bytes_;  // 已分配出去还没释放的字节数
+        uint64_t thread_cached_bytes_;
+        uint64_t depot_bytes_;
+    };
+
+    // 至少 size 字节, *capacity 返回实际可用的大小. 失败返回 NULL
+    static void *Alloc(size_t size, size_t *capacity);
+    static void Free(void *ptr, size_t capacity);
+    // 扩容并保留开头 used 字节; 新旧都超过最大级别时用 realloc, 可能原地扩大. 失败时 ptr 不变, 返回 NULL
+    static void *Realloc(void *ptr, size_t capacity, size_t used, size_t size,
+                         size_t *new_capacity);
+
+    static Stats GetStats();
+    // 当前线程缓存的块还给仓库
+    static void FlushThreadCache();
+    // 释放仓库里的所有块
+    static void Trim();
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "chain_buffer.h"
+
+#include <new>
+#include <sys/mman.h>
+
+///////////// CBufferBlock ////////////////
+CBufferBlock::CBufferBlock(Type type, char *data, size_t size, size_t capacity,
+                           void *map_addr, size_t map_len)
+    : type_(type), data_(data), size_(size), capacity_(capacity), map_addr_(map_addr),
+      map_len_(map_len) {}
+
+CBufferBlock::~CBufferBlock() {
+    if (type_ == BLOCK_OWNED)
+        free(data_);
+    else if (type_ == BLOCK_MMAP)
+        munmap(map_addr_, map_len_);
+}
+
+IntrusivePtr<CBufferBlock> CBufferBlock::NewOwned(size_t capacity) {
+    char *data = (char *)malloc(capacity);
+    if (data == NULL)
+        throw std::bad_alloc();
+    return IntrusivePtr<CBufferBlock>(
+        new CBufferBlock(BLOCK_OWNED, data, 0, capacity, NULL, 0), false);
+}
+
+IntrusivePtr<CBufferBlock> CBufferBlock::NewStatic(const void *data, size_t len) {
+    return IntrusivePtr<CBufferBlock>(
+        new CBufferBlock(BLOCK_STATIC, (char *)data, len, len, NULL, 0), false);
+}
+
+IntrusivePtr<CBufferBlock> CBufferBlock::NewMmap(int fd, off_t offset, size_t len) {
+    if (fd < 0 || offset < 0 || len == 0)
+        return IntrusivePtr<CBufferBlock>();
+
+    // mmap 的偏移必须页对齐, 多映射的部分在切片里跳过
+    static const off_t page_size = sysconf(_SC_PAGESIZE);
+    off_t aligned = offset - offset % page_size;
+    size_t map_len = len + (size_t)(offset - aligned);
+    void *addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, aligned);
+    if (addr == MAP_FAILED)
+        return IntrusivePtr<CBufferBlock>();
+
+    char *data = (char *)addr + (offset - aligned);
+    return IntrusivePtr<CBufferBlock>(
+        new CBufferBlock(BLOCK_MMAP, data, len, len, addr, map_len), false);
+}
+
+///////////// CChainBuffer ////////////////
+CChainBuffer::CChainBuffer() : length_(0) {}
+
+CChainBuffer::~CChainBuffer() {}
+
+void CChainBuffer::Append(const void *data, size_t len) {
+    const char *src = (const char *)data;
+    if (!slices_.empty()) {
+        // 最后一个切片正好停在独占自有块的末尾时, 直接写进块的空闲部分
+        Slice &last = slices_.back();
+        CBufferBlock *block = last.block_.get();
+        if (block->type_ == CBufferBlock::BLOCK_OWNED && block->IsUnique() &&
+            last.offset_ + last.len_ == block->size_) {
+            size_t n = block->capacity_ - block->size_;
+            if (n > len)
+                n = len;
+            memcpy(block->data_ + block->size_, src, n);
+            block->size_ += n;
+            last.len_ += n;
+            length_ += n;
+            src += n;
+            len -= n;
+        }
+    }
+
+    if (len == 0)
+        return;
+
+    size_t capacity = kBlockSize;
+    if (len > capacity)
+        capacity = len;
+    IntrusivePtr<CBufferBlock> block = CBufferBlock::NewOwned(capacity);
+    memcpy(block->data_, src, len);
+    block->size_ = len;
+    AppendBlock(block, 0, len);
+}
+
+void CChainBuffer::AppendStatic(const void *data, size_t len) {
+    if (len == 0)
+        return;
+    AppendBlock(CBufferBlock::NewStatic(data, len), 0, len);
+}
+
+void CChainBuffer::AppendBlock(const IntrusivePtr<CBufferBlock> &block, size_t offset,
+                               size_t len) {
+    if (!block || len == 0)
+        return;
+
+    Slice slice;
+    slice.block_ = block;
+    slice.offset_ = offset;
+    slice.len_ = len;
+    slices_.push_back(slice);
+    length_ += len;
+}
+
+void CChainBuffer::AppendChain(const CChainBuffer &other) {
+    // 先取长度: other 是自己时 push_back 会让 size() 一直增长
+    size_t cnt = other.slices_.size();
+    for (size_t i = 0; i < cnt; i++) {
+        const Slice &slice = other.slices_[i];
+        AppendBlock(slice.block_, slice.offset_, slice.len_);
+    }
+}
+
+bool CChainBuffer::AppendFile(int fd, off_t offset, size_t len) {
+    if (len == 0)
+        return true;
+
+    IntrusivePtr<CBufferBlock> block = CBufferBlock::NewMmap(fd, offset, len);
+    if (!block)
+        return false;
+
+    AppendBlock(block, 0, len);
+    return true;
+}
+
+int CChainBuffer::GetIovec(struct iovec *iov, int max) const {
+    int cnt = 0;
+    for (size_t i = 0; i < slices_.size() && cnt < max; i++, cnt++) {
+        const Slice &slice = slices_[i];
+        iov[cnt].iov_base = slice.block_->data_ + slice.offset_;
+        iov[cnt].iov_len = slice.len_;
+    }
+    return cnt;
+}
+
+void CChainBuffer::Consume(size_t len) {
+    while (len > 0 && !slices_.empty()) {
+        Slice &front = slices_.front();
+        if (len < front.len_) {
+            front.offset_ += len;
+            front.len_ -= len;
+            length_ -= len;
+            return;
+        }
+
+        len -= front.len_;
+        length_ -= front.len_;
+        slices_.pop_front();
+    }
+}
+
+ssize_t CChainBuffer::WriteTo(int fd) {
+    struct iovec iov[kMaxIovec];
+    int cnt = GetIovec(iov, kMaxIovec);
+    if (cnt == 0)
+        return 0;
+
+    ssize_t ret = writev(fd, iov, cnt);
+    if (ret > 0)
+        Consume(ret);
+    return ret;
+}
+
+void CChainBuffer::Clear() {
+    slices_.clear();
+    length_ = 0;
+}
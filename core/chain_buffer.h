@@ -0,0 +1,98 @@
+#ifndef __CHAIN_BUFFER_H__
+#define __CHAIN_BUFFER_H__
+
+#include "util.h"
+
+#include <deque>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// 链式缓冲区的数据块, 引用计数可以跨线程增减. 块一旦被多个缓冲区共享, 内容就不再修改
+class CBufferBlock : public CRefObject {
+  public:
+    enum Type {
+        BLOCK_OWNED = 0,  // malloc 出来的内存, 可以继续往尾部追加
+        BLOCK_STATIC = 1, // 借用的内存(字符串常量, 全局表等), 不释放, 调用方保证比块活得久
+        BLOCK_MMAP = 2,   // mmap 的文件区域, 析构时 munmap
+    };
+
+    static IntrusivePtr<CBufferBlock> NewOwned(size_t capacity);
+    static IntrusivePtr<CBufferBlock> NewStatic(const void *data, size_t len);
+    // 映射文件 fd 的 [offset, offset + len), offset 不需要页对齐; 失败返回空指针
+    static IntrusivePtr<CBufferBlock> NewMmap(int fd, off_t offset, size_t len);
+
+    Type GetType() const { return type_; }
+    char *GetData() const { return data_; }
+    // 有效数据长度, 只有 BLOCK_OWNED 会增长
+    size_t GetSize() const { return size_; }
+    size_t GetCapacity() const { return capacity_; }
+
+  private:
+    friend class CChainBuffer;
+
+    CBufferBlock(Type type, char *data, size_t size, size_t capacity, void *map_addr,
+                 size_t map_len);
+    virtual ~CBufferBlock();
+
+    Type type_;
+    char *data_;
+    size_t size_;
+    size_t capacity_;
+    void *map_addr_; // BLOCK_MMAP 时为页对齐的映射起点
+    size_t map_len_;
+};
+
+// 由数据块切片组成的发送缓冲区, 拼响应时不把各部分复制到一块连续内存里:
+// 小块数据复制进自有块, 大块常量和文件内容只引用不复制, 发送时导出 iovec 交给 writev / sendmsg.
+// 同一个块可以被多个缓冲区共享(比如缓存的热点图片), 单个 CChainBuffer 本身不是线程安全的
+//
+//     CChainBuffer resp;
+//     resp.Append(header.data(), header.size());
+//     resp.AppendFile(fd, 0, file_size);
+//     while (resp.GetLength() > 0 && resp.WriteTo(sock) > 0) {}
+class CChainBuffer {
+  public:
+    static const size_t kBlockSize = 16 * 1024; // 复制追加时新建块的默认大小
+    static const int kMaxIovec = 64;            // WriteTo 一次最多提交的切片数
+
+    CChainBuffer();
+    ~CChainBuffer();
+
+    size_t GetLength() const { return length_; }
+    size_t GetSliceCnt() const { return slices_.size(); }
+
+    // 复制追加, 优先写进最后一个独占的自有块的空闲尾部
+    void Append(const void *data, size_t len);
+    void Append(const string &str) { Append(str.data(), str.size()); }
+    // 不复制, data 要在发送完之前一直有效
+    void AppendStatic(const void *data, size_t len);
+    // 引用块的 [offset, offset + len)
+    void AppendBlock(const IntrusivePtr<CBufferBlock> &block, size_t offset, size_t len);
+    // 共享 other 的所有切片, 不复制数据
+    void AppendChain(const CChainBuffer &other);
+    // mmap 文件区域, 失败返回 false 且缓冲区不变
+    bool AppendFile(int fd, off_t offset, size_t len);
+
+    // 从头开始最多填 max 个 iovec, 返回填了几个
+    int GetIovec(struct iovec *iov, int max) const;
+    // 丢掉开头 len 字节, 用于 writev 部分写出之后
+    void Consume(size_t len);
+    // writev 一次, 成功时丢掉已写出的部分; 返回值同 writev
+    ssize_t WriteTo(int fd);
+    void Clear();
+
+  private:
+    CChainBuffer(const CChainBuffer &);
+    CChainBuffer &operator=(const CChainBuffer &);
+
+    struct Slice {
+        IntrusivePtr<CBufferBlock> block_;
+        size_t offset_;
+        size_t len_;
+    };
+
+    std::deque<Slice> slices_;
+    size_t length_;
+};
+
+#endif
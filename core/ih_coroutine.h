@@ -0,0 +1,289 @@
+#ifndef _IH_COROUTINE_H_
+#define _IH_COROUTINE_H_
+
+// C++20 协程执行器: 请求处理函数写成 Task<T> 协程, co_await 缓存/数据库操作时
+// 不占用线程池线程. 需要 -std=c++20, 低版本编译时本文件为空.
+//
+//     Task<int> CountFiles(ThreadPool& pool, std::string user) {
+//         co_await ScheduleOn(pool);               // 切到线程池上执行
+//         int n = co_await Async(pool, QueryCount, user);  // 等 Future 不阻塞线程
+//         co_return n;
+//     }
+//
+//     Spawn(pool, HandleRequest(pool, conn));      // 发起, 不等结果
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+#include "ih_future.h"
+#include "ih_thread_pool.h"
+
+template <class T = void> class Task;
+
+struct TaskPromiseBase {
+    // 协程结束时对称转移到等待它的协程, 不经过线程池也不额外分配
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation_;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr error_;
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase {
+    Task<T> get_return_object();
+
+    template <class V>
+    void return_value(V&& value) { value_.emplace(std::forward<V>(value)); }
+
+    T Result() {
+        if(error_)
+            std::rethrow_exception(error_);
+        return std::move(*value_);
+    }
+
+    std::optional<T> value_;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void Result() {
+        if(error_)
+            std::rethrow_exception(error_);
+    }
+};
+
+// 惰性启动的协程: 第一次被 co_await 时才开始执行, 执行完后恢复等待者.
+// 只能移动, 析构时销毁协程帧
+template <class T>
+class Task {
+
+public:
+    typedef TaskPromise<T> promise_type;
+
+    Task() {}
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            if(handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if(handle_)
+            handle_.destroy();
+    }
+
+    // 空的 Task(默认构造或已被移走)不挂起, co_await 抛出 std::future_error(no_state)
+    bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation_ = awaiting;
+        return handle_;
+    }
+
+    T await_resume() {
+        if(!handle_)
+            throw std::future_error(std::future_errc::no_state);
+        return handle_.promise().Result();
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <class T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+// co_await ScheduleOn(pool): 把当前协程的后续部分投递到 pool 上执行.
+// 投递的只是一个协程句柄, 内联存放在任务槽位里, 恢复时不做堆分配.
+// 线程池拒绝, 丢弃或已经 Stop 时协程在取消它的线程上恢复, co_await 抛出 std::system_error
+class ScheduleOn {
+
+public:
+    explicit ScheduleOn(ThreadPool& pool, ThreadPool::Lane lane = ThreadPool::LANE_NORMAL)
+        : pool_(pool), lane_(lane) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        pool_.Post(lane_, Resumer(h, this));
+    }
+
+    void await_resume() const {
+        if(cancelled_)
+            throw std::system_error(std::make_error_code(error_));
+    }
+
+private:
+    // 任务没有执行就被销毁(线程池析构时还在排队)也按取消处理, 协程帧不会泄漏
+    struct Resumer {
+        Resumer(std::coroutine_handle<> h, ScheduleOn* awaiter) : h_(h), awaiter_(awaiter) {}
+        Resumer(Resumer&& other) noexcept
+            : h_(std::exchange(other.h_, nullptr)), awaiter_(other.awaiter_) {}
+        ~Resumer() {
+            if(h_)
+                Cancel(std::errc::operation_canceled);
+        }
+
+        void operator()() { std::exchange(h_, nullptr).resume(); }
+
+        void Cancel(std::errc code) {
+            awaiter_->cancelled_ = true;
+            awaiter_->error_ = code;
+            std::exchange(h_, nullptr).resume();
+        }
+
+        std::coroutine_handle<> h_;
+        ScheduleOn* awaiter_;
+    };
+
+    ThreadPool& pool_;
+    ThreadPool::Lane lane_;
+    bool cancelled_ = false;
+    std::errc error_ = std::errc::operation_canceled;
+};
+
+// co_await 一个 Future: 结果就绪时在完成它的线程上恢复协程
+template <class T>
+class FutureAwaiter {
+
+public:
+    explicit FutureAwaiter(Future<T>&& future) : future_(std::move(future)) {}
+
+    bool await_ready() const { return future_.IsReady(); }
+
+    // 挂回调时已经就绪则返回 false 直接继续, 一串就绪的 co_await 不会在栈上层层嵌套
+    bool await_suspend(std::coroutine_handle<> h) {
+        // 回调可能在别的线程上立即执行并销毁本协程帧, 之后不能再访问成员
+        std::shared_ptr<FutureState<T> > state = future_.GetState();
+        return state->OnReadyLater([h]{ h.resume(); });
+    }
+
+    T await_resume() { return future_.Get(); }
+
+private:
+    Future<T> future_;
+};
+
+template <class T>
+FutureAwaiter<T> operator co_await(Future<T>&& future) {
+    return FutureAwaiter<T>(std::move(future));
+}
+
+// 不被等待的协程, 帧在结束时自动销毁
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept { return DetachedTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {}
+    };
+};
+
+// 在 pool 上启动 task, 不等待结果. task 抛出的异常被丢弃
+inline DetachedTask Spawn(ThreadPool& pool, Task<void> task) {
+    co_await ScheduleOn(pool);
+    try {
+        co_await task;
+    }
+    catch(...) {
+    }
+}
+
+struct SyncWaitState {
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool done_ = false;
+    std::exception_ptr error_;
+};
+
+template <class T>
+DetachedTask SyncWaitRun(Task<T>& task, std::optional<T>& value, SyncWaitState& state) {
+    try {
+        value.emplace(co_await task);
+    }
+    catch(...) {
+        state.error_ = std::current_exception();
+    }
+    // 持锁通知: 等待方醒来后 state 就失效了
+    std::unique_lock<std::mutex> lock(state.mutex_);
+    state.done_ = true;
+    state.cond_.notify_all();
+}
+
+inline DetachedTask SyncWaitRun(Task<void>& task, SyncWaitState& state) {
+    try {
+        co_await task;
+    }
+    catch(...) {
+        state.error_ = std::current_exception();
+    }
+    std::unique_lock<std::mutex> lock(state.mutex_);
+    state.done_ = true;
+    state.cond_.notify_all();
+}
+
+inline void SyncWaitBlock(SyncWaitState& state) {
+    std::unique_lock<std::mutex> lock(state.mutex_);
+    state.cond_.wait(lock, [&state]{ return state.done_; });
+    if(state.error_)
+        std::rethrow_exception(state.error_);
+}
+
+// 阻塞当前线程直到 task 完成, 用于 main 或测试, 不要在线程池线程里调用
+template <class T>
+T SyncWait(Task<T> task) {
+    std::optional<T> value;
+    SyncWaitState state;
+    SyncWaitRun(task, value, state);
+    SyncWaitBlock(state);
+    return std::move(*value);
+}
+
+inline void SyncWait(Task<void> task) {
+    SyncWaitState state;
+    SyncWaitRun(task, state);
+    SyncWaitBlock(state);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _IH_FUTEX_H_
+#define _IH_FUTEX_H_
+
+#include <atomic>
+#include <limits.h>
+#include <stdint.h>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// 基于 futex 的挂起/唤醒, 等待方直接睡在一个 32 位原子变量上, 不需要互斥锁和条件变量.
+// 非 Linux 平台退化为让出 cpu 的忙等.
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+// *addr 仍等于 expected 时睡眠, 直到被 FutexWake 唤醒或超时(timeoutMs < 0 为不超时).
+// 可能虚假唤醒, 调用方需要重新检查条件
+inline void FutexWait(std::atomic<uint32_t>* addr, uint32_t expected, int timeoutMs = -1) {
+
+#ifdef __linux__
+    struct timespec ts;
+    struct timespec* timeout = NULL;
+    if(timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+        timeout = &ts;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+#else
+    (void)timeoutMs;
+    if(addr->load(std::memory_order_acquire) == expected)
+        std::this_thread::yield();
+#endif
+}
+
+// 唤醒最多 num 个睡在 addr 上的线程
+inline void FutexWake(std::atomic<uint32_t>* addr, int num) {
+
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+#else
+    (void)addr;
+    (void)num;
+#endif
+}
+
+inline void FutexWakeAll(std::atomic<uint32_t>* addr) {
+
+    FutexWake(addr, INT_MAX);
+}
+
+// 自旋等待时降低功耗, 也让超线程的另一半跑得更快
+inline void CpuRelax() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+#endif
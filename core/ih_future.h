@@ -0,0 +1,493 @@
+#ifndef _IH_FUTURE_H_
+#define _IH_FUTURE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ih_task.h"
+#include "ih_thread_pool.h"
+
+// 建立在 ThreadPool 之上的轻量 Future/Promise: 结果就绪后通过 Then 把后续步骤投递到
+// 线程池, WhenAll/WhenAny 合并多个异步结果, 整条请求链上不需要有线程阻塞在 Get() 上.
+//
+//     Async(pool, WriteRedis, md5)
+//         .Then(pool, [](int ret) { return InsertShare(ret); })
+//         .Then(pool, [conn](bool ok) { conn->SendJson(ok); });
+//
+// Future 只能移动, Get/Then 都只能调用一次. Promise 没有设置结果就析构时,
+// 对应的 Future 以 std::future_errc::broken_promise 完成.
+
+struct FutureUnit {};
+
+template <class T> struct FutureValue { typedef T type; };
+template <> struct FutureValue<void> { typedef FutureUnit type; };
+
+template <class T> class Future;
+template <class T> class Promise;
+
+template <class T>
+struct FutureState {
+    typedef typename FutureValue<T>::type Value;
+
+    void SetValue(Value&& value) {
+        Complete([&]{ value_.emplace(std::move(value)); });
+    }
+
+    void SetException(std::exception_ptr error) {
+        Complete([&]{ error_ = error; });
+    }
+
+    // 就绪时调用 callback: 已经就绪时在当前线程立即调用, 否则在完成结果的线程上调用.
+    // 每个状态只保存一个回调
+    template <class F>
+    void OnReady(F&& callback) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(!ready_) {
+            callback_.Assign(std::forward<F>(callback));
+            return;
+        }
+        lock.unlock();
+        callback();
+    }
+
+    // 未就绪时保存回调并返回 true; 已经就绪时不调用回调, 返回 false
+    template <class F>
+    bool OnReadyLater(F&& callback) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(ready_)
+            return false;
+        callback_.Assign(std::forward<F>(callback));
+        return true;
+    }
+
+    bool IsReady() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return ready_;
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]{ return ready_; });
+    }
+
+    Value Take() {
+        Wait();
+        if(error_)
+            std::rethrow_exception(error_);
+        return std::move(*value_);
+    }
+
+    template <class Setter>
+    void Complete(Setter&& set) {
+        InlineTask<ThreadPool::kTaskInlineSize> callback;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(ready_)
+                throw std::future_error(std::future_errc::promise_already_satisfied);
+            set();
+            ready_ = true;
+            callback = std::move(callback_);
+        }
+        cond_.notify_all();
+        if(callback)
+            callback();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool ready_ = false;
+    std::optional<Value> value_;
+    std::exception_ptr error_;
+    InlineTask<ThreadPool::kTaskInlineSize> callback_;
+};
+
+template <class T>
+class Promise {
+
+public:
+    typedef typename FutureValue<T>::type Value;
+
+    Promise() : state_(std::make_shared<FutureState<T> >()) {}
+    Promise(Promise&& other) = default;
+    Promise& operator=(Promise&& other) {
+        if(this != &other) {
+            Abandon();
+            state_ = std::move(other.state_);
+        }
+        return *this;
+    }
+    ~Promise() { Abandon(); }
+
+    Future<T> GetFuture() { return Future<T>(state_); }
+
+    template <class V>
+    void SetValue(V&& value) {
+        Release()->SetValue(Value(std::forward<V>(value)));
+    }
+
+    // 仅用于 Promise<void>
+    void SetValue() { Release()->SetValue(Value()); }
+
+    void SetException(std::exception_ptr error) { Release()->SetException(error); }
+
+private:
+    std::shared_ptr<FutureState<T> > Release() {
+        if(!state_)
+            throw std::future_error(std::future_errc::no_state);
+        return std::move(state_);
+    }
+
+    void Abandon() {
+        if(state_) {
+            Release()->SetException(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    std::shared_ptr<FutureState<T> > state_;
+};
+
+// Then 的回调参数: Future<void> 的回调不带参数
+template <class T>
+struct FutureInvoke {
+    template <class F>
+    static auto Call(F& f, T&& value) -> decltype(f(std::move(value))) {
+        return f(std::move(value));
+    }
+};
+
+template <>
+struct FutureInvoke<void> {
+    template <class F>
+    static auto Call(F& f, FutureUnit&&) -> decltype(f()) {
+        return f();
+    }
+};
+
+// 回调返回 Future<U> 时结果展开为 Future<U>, 而不是 Future<Future<U>>
+template <class R> struct FutureFlatten { typedef R type; };
+template <class U> struct FutureFlatten<Future<U> > { typedef U type; };
+
+template <class R>
+struct FutureFulfill {
+    template <class Call>
+    static void Run(Promise<R>& promise, Call&& call) {
+        promise.SetValue(call());
+    }
+};
+
+template <>
+struct FutureFulfill<void> {
+    template <class Call>
+    static void Run(Promise<void>& promise, Call&& call) {
+        call();
+        promise.SetValue();
+    }
+};
+
+template <class U>
+struct FutureFulfill<Future<U> > {
+    template <class Call>
+    static void Run(Promise<U>& promise, Call&& call) {
+        Future<U> inner = call();
+        if(!inner.Valid()) {
+            promise.SetException(std::make_exception_ptr(
+                std::future_error(std::future_errc::no_state)));
+            return;
+        }
+
+        std::shared_ptr<FutureState<U> > state = inner.GetState();
+        state->OnReady([state, promise = std::move(promise)]() mutable {
+            if(state->error_)
+                promise.SetException(state->error_);
+            else
+                promise.SetValue(std::move(*state->value_));
+        });
+    }
+};
+
+// 投递到线程池的异步步骤: 执行时用 call() 的结果完成 promise; 线程池拒绝或丢弃任务时
+// 以 std::system_error(code) 完成, 等待方不会一直挂着
+template <class R, class Call>
+struct FutureTask {
+    typedef typename FutureFlatten<R>::type U;
+
+    FutureTask(Call&& call, Promise<U>&& promise)
+        : call_(std::move(call)), promise_(std::move(promise)) {}
+
+    void operator()() {
+        try {
+            FutureFulfill<R>::Run(promise_, call_);
+        }
+        catch(...) {
+            promise_.SetException(std::current_exception());
+        }
+    }
+
+    void Cancel(std::errc code) {
+        promise_.SetException(std::make_exception_ptr(
+            std::system_error(std::make_error_code(code))));
+    }
+
+    Call call_;
+    Promise<U> promise_;
+};
+
+template <class T>
+class Future {
+
+public:
+    typedef typename FutureValue<T>::type Value;
+
+    template <class F>
+    using ThenResult = decltype(FutureInvoke<T>::Call(std::declval<F&>(), std::declval<Value>()));
+
+    Future() {}
+    explicit Future(std::shared_ptr<FutureState<T> > state) : state_(std::move(state)) {}
+    Future(Future&& other) = default;
+    Future& operator=(Future&& other) = default;
+
+    bool Valid() const { return state_ != NULL; }
+    bool IsReady() const { return state_ && state_->IsReady(); }
+    void Wait() const { state_->Wait(); }
+
+    // 阻塞等待结果. 只在请求链的尽头或测试里用, 处理流程里应该用 Then
+    T Get() {
+        std::shared_ptr<FutureState<T> > state = Release();
+        return static_cast<T>(state->Take());
+    }
+
+    // 就绪后把 f(value) 投递到 pool 上执行, 返回 f 的结果. 本 Future 出错时不调用 f,
+    // 错误直接传给返回的 Future; 线程池拒绝或丢弃这一步时以 std::system_error 完成
+    template <class F>
+    auto Then(ThreadPool& pool, F&& f)
+        -> Future<typename FutureFlatten<ThenResult<typename std::decay<F>::type> >::type> {
+        return Chain(&pool, std::forward<F>(f));
+    }
+
+    // 就绪后在完成结果的线程上直接执行 f, 适合很短的回调
+    template <class F>
+    auto Then(F&& f)
+        -> Future<typename FutureFlatten<ThenResult<typename std::decay<F>::type> >::type> {
+        return Chain(NULL, std::forward<F>(f));
+    }
+
+    std::shared_ptr<FutureState<T> > GetState() const { return state_; }
+
+private:
+    std::shared_ptr<FutureState<T> > Release() {
+        if(!state_)
+            throw std::future_error(std::future_errc::no_state);
+        return std::move(state_);
+    }
+
+    template <class F>
+    auto Chain(ThreadPool* pool, F&& f)
+        -> Future<typename FutureFlatten<ThenResult<typename std::decay<F>::type> >::type> {
+
+        typedef typename std::decay<F>::type Fn;
+        typedef ThenResult<Fn> R;
+        typedef typename FutureFlatten<R>::type U;
+
+        Promise<U> promise;
+        Future<U> result = promise.GetFuture();
+        std::shared_ptr<FutureState<T> > state = Release();
+
+        // 本 Future 的错误重新抛出, 由 FutureTask 原样传给返回的 Future
+        auto call = [state, fn = Fn(std::forward<F>(f))]() mutable -> R {
+            if(state->error_)
+                std::rethrow_exception(state->error_);
+            return FutureInvoke<T>::Call(fn, std::move(*state->value_));
+        };
+        FutureTask<R, decltype(call)> next(std::move(call), std::move(promise));
+
+        if(pool == NULL) {
+            state->OnReady(std::move(next));
+        }
+        else {
+            state->OnReady([pool, next = std::move(next)]() mutable {
+                pool->Post(std::move(next));
+            });
+        }
+        return result;
+    }
+
+    std::shared_ptr<FutureState<T> > state_;
+};
+
+template <class T>
+Future<typename std::decay<T>::type> MakeReadyFuture(T&& value) {
+    Promise<typename std::decay<T>::type> promise;
+    Future<typename std::decay<T>::type> future = promise.GetFuture();
+    promise.SetValue(std::forward<T>(value));
+    return future;
+}
+
+inline Future<void> MakeReadyFuture() {
+    Promise<void> promise;
+    Future<void> future = promise.GetFuture();
+    promise.SetValue();
+    return future;
+}
+
+template <class T>
+Future<T> MakeExceptionalFuture(std::exception_ptr error) {
+    Promise<T> promise;
+    Future<T> future = promise.GetFuture();
+    promise.SetException(error);
+    return future;
+}
+
+// 在 pool 上执行 f(args...), 返回 Future. f 返回 Future<U> 时结果展开为 Future<U>
+template <class F, class... Args>
+auto Async(ThreadPool& pool, F&& f, Args&&... args)
+    -> Future<typename FutureFlatten<decltype(f(args...))>::type> {
+
+    typedef decltype(f(args...)) R;
+    typedef typename FutureFlatten<R>::type U;
+
+    Promise<U> promise;
+    Future<U> future = promise.GetFuture();
+    auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    pool.Post(FutureTask<R, decltype(bound)>(std::move(bound), std::move(promise)));
+    return future;
+}
+
+// WhenAll / WhenAny 的输入: 无效的 Future(默认构造或已被 Get/Then 移走)没有共享状态,
+// 换成以 std::future_error(no_state) 完成的 Future
+template <class T>
+void ReplaceInvalidFuture(Future<T>& future) {
+    if(!future.Valid())
+        future = MakeExceptionalFuture<T>(std::make_exception_ptr(
+            std::future_error(std::future_errc::no_state)));
+}
+
+// 所有 Future 都就绪后完成, 结果里是已就绪的各个 Future, 各自的值或错误分别 Get.
+// 无效的输入在结果里对应一个以 std::future_error(no_state) 完成的 Future
+template <class T>
+Future<std::vector<Future<T> > > WhenAll(std::vector<Future<T> > futures) {
+
+    struct Context {
+        std::vector<Future<T> > futures;
+        std::atomic<size_t> remaining;
+        Promise<std::vector<Future<T> > > promise;
+    };
+
+    std::shared_ptr<Context> ctx = std::make_shared<Context>();
+    ctx->futures = std::move(futures);
+    ctx->remaining = ctx->futures.size();
+    Future<std::vector<Future<T> > > result = ctx->promise.GetFuture();
+
+    if(ctx->futures.empty()) {
+        ctx->promise.SetValue(std::move(ctx->futures));
+        return result;
+    }
+
+    // 先取出所有状态再挂回调: 已就绪的 Future 会同步触发回调并移走 ctx->futures
+    std::vector<std::shared_ptr<FutureState<T> > > states;
+    for(size_t i = 0; i < ctx->futures.size(); i++) {
+        ReplaceInvalidFuture(ctx->futures[i]);
+        states.push_back(ctx->futures[i].GetState());
+    }
+
+    for(size_t i = 0; i < states.size(); i++) {
+        states[i]->OnReady([ctx]{
+            if(--ctx->remaining == 0)
+                ctx->promise.SetValue(std::move(ctx->futures));
+        });
+    }
+    return result;
+}
+
+template <class... Ts>
+Future<std::tuple<Future<Ts>...> > WhenAll(Future<Ts>&&... futures) {
+
+    struct Context {
+        explicit Context(Future<Ts>&&... f) : futures(std::move(f)...), remaining(sizeof...(Ts)) {}
+
+        std::tuple<Future<Ts>...> futures;
+        std::atomic<size_t> remaining;
+        Promise<std::tuple<Future<Ts>...> > promise;
+    };
+
+    std::shared_ptr<Context> ctx = std::make_shared<Context>(std::move(futures)...);
+    Future<std::tuple<Future<Ts>...> > result = ctx->promise.GetFuture();
+
+    if(sizeof...(Ts) == 0) {
+        ctx->promise.SetValue(std::move(ctx->futures));
+        return result;
+    }
+
+    auto states = std::apply([](Future<Ts>&... f) {
+        (ReplaceInvalidFuture(f), ...);
+        return std::make_tuple(f.GetState()...);
+    }, ctx->futures);
+
+    std::apply([&ctx](auto&... state) {
+        (state->OnReady([ctx]{
+            if(--ctx->remaining == 0)
+                ctx->promise.SetValue(std::move(ctx->futures));
+        }), ...);
+    }, states);
+    return result;
+}
+
+template <class T>
+struct WhenAnyResult {
+    size_t index;                     // 最先就绪的下标
+    std::vector<Future<T> > futures;
+};
+
+// 任意一个 Future 就绪即完成. 其余 Future 仍可以继续 Then/Get.
+// 无效的输入视为已经以 std::future_error(no_state) 完成
+template <class T>
+Future<WhenAnyResult<T> > WhenAny(std::vector<Future<T> > futures) {
+
+    struct Context {
+        std::vector<Future<T> > futures;
+        std::atomic<bool> done{false};
+        Promise<WhenAnyResult<T> > promise;
+    };
+
+    std::shared_ptr<Context> ctx = std::make_shared<Context>();
+    ctx->futures = std::move(futures);
+    Future<WhenAnyResult<T> > result = ctx->promise.GetFuture();
+
+    if(ctx->futures.empty()) {
+        ctx->promise.SetException(std::make_exception_ptr(
+            std::future_error(std::future_errc::no_state)));
+        return result;
+    }
+
+    std::vector<std::shared_ptr<FutureState<T> > > states;
+    for(size_t i = 0; i < ctx->futures.size(); i++) {
+        ReplaceInvalidFuture(ctx->futures[i]);
+        states.push_back(ctx->futures[i].GetState());
+    }
+
+    for(size_t i = 0; i < states.size(); i++) {
+        states[i]->OnReady([ctx, i]{
+            if(ctx->done.exchange(true))
+                return;
+            WhenAnyResult<T> any;
+            any.index = i;
+            any.futures = std::move(ctx->futures);
+            ctx->promise.SetValue(std::move(any));
+        });
+        if(ctx->done)
+            break;
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef _IH_HISTOGRAM_H_
+#define _IH_HISTOGRAM_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// HDR 风格的对数线性直方图, 记录微秒级耗时. 每个 2 的幂区间再均分成 8 个子桶,
+// 相对误差不超过 12.5%, 最大记录 2^32 微秒(约 71 分钟), 更大的值归入最后一个桶.
+//
+// LatencyHistogram 设计为单写多读: 只有所属的工作线程调用 Record, 计数用
+// relaxed 的读-加-写, 不需要原子 RMW; 其他线程随时可以 AddTo 做快照.
+// 多个线程同时写时用 RecordShared.
+
+class HistogramSnapshot;
+
+class LatencyHistogram {
+
+public:
+    static const int kSubBits = 3;
+    static const int kSubCount = 1 << kSubBits;
+    static const int kMaxBits = 32;
+    static const int kBucketNum = (kMaxBits - kSubBits + 1) * kSubCount;
+
+    LatencyHistogram() {
+        for(int i = 0; i < kBucketNum; i++)
+            counts_[i].store(0, std::memory_order_relaxed);
+    }
+
+    static int BucketOf(uint64_t value) {
+        if(value >= ((uint64_t)1 << kMaxBits))
+            return kBucketNum - 1;
+        if(value < (uint64_t)kSubCount)
+            return (int)value;
+
+        int exp = 63 - __builtin_clzll(value);
+        int sub = (int)(value >> (exp - kSubBits)) & (kSubCount - 1);
+        return (exp - kSubBits + 1) * kSubCount + sub;
+    }
+
+    // 桶内最大值, 用于报告分位数
+    static uint64_t BucketUpper(int bucket) {
+        if(bucket < kSubCount)
+            return (uint64_t)bucket;
+
+        int exp = bucket / kSubCount + kSubBits - 1;
+        uint64_t sub = (uint64_t)(bucket % kSubCount);
+        uint64_t lower = (kSubCount + sub) << (exp - kSubBits);
+        return lower + ((uint64_t)1 << (exp - kSubBits)) - 1;
+    }
+
+    void Record(uint64_t value) {
+        Bump(counts_[BucketOf(value)], 1);
+        Bump(count_, 1);
+        Bump(sum_, value);
+        if(value > max_.load(std::memory_order_relaxed))
+            max_.store(value, std::memory_order_relaxed);
+    }
+
+    void RecordShared(uint64_t value) {
+        counts_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while(value > max &&
+              !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    void AddTo(HistogramSnapshot& snap) const;
+
+private:
+    static void Bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta,
+                      std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> counts_[kBucketNum];
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// 直方图的只读副本, 可以合并多个线程的数据后计算分位数
+class HistogramSnapshot {
+
+public:
+    HistogramSnapshot() : counts_(LatencyHistogram::kBucketNum, 0), count_(0), sum_(0), max_(0) {}
+
+    uint64_t GetCount() const { return count_; }
+    uint64_t GetSum() const { return sum_; }
+    uint64_t GetMax() const { return max_; }
+    uint64_t GetMean() const { return count_ == 0 ? 0 : sum_ / count_; }
+
+    // p 取 0-100, 返回不小于该分位的桶上界(微秒)
+    uint64_t Percentile(double p) const {
+        if(count_ == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(p / 100.0 * (double)count_ + 0.5);
+        if(rank == 0)
+            rank = 1;
+
+        uint64_t seen = 0;
+        for(int i = 0; i < LatencyHistogram::kBucketNum; i++) {
+            seen += counts_[i];
+            if(seen >= rank) {
+                uint64_t upper = LatencyHistogram::BucketUpper(i);
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    void Merge(const HistogramSnapshot& other) {
+        for(int i = 0; i < LatencyHistogram::kBucketNum; i++)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if(other.max_ > max_)
+            max_ = other.max_;
+    }
+
+private:
+    friend class LatencyHistogram;
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+inline void LatencyHistogram::AddTo(HistogramSnapshot& snap) const {
+    // 各计数分别读取, 快照和正在写入的数据之间允许有极小的偏差
+    for(int i = 0; i < kBucketNum; i++)
+        snap.counts_[i] += counts_[i].load(std::memory_order_relaxed);
+    snap.count_ += count_.load(std::memory_order_relaxed);
+    snap.sum_ += sum_.load(std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    if(max > snap.max_)
+        snap.max_ = max;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _IH_MPMC_RING_H_
+#define _IH_MPMC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 有界无锁多生产者多消费者队列(Vyukov 算法). 每个槽位带一个序号:
+// 序号等于写位置时可写, 等于写位置 + 1 时可读, 读完后加上容量留给下一圈.
+// 生产者之间只在 tail_ 上 CAS, 消费者之间只在 head_ 上 CAS, 两边互不加锁.
+// 容量按 2 的幂向上取整, 创建后不再变化. T 的移动构造不能抛异常.
+template <class T>
+class MpmcRing {
+
+public:
+    explicit MpmcRing(size_t capacity) : head_(0), tail_(0) {
+        size_t cap = 2;
+        while(cap < capacity)
+            cap *= 2;
+
+        mask_ = cap - 1;
+        cells_ = new Cell[cap];
+        for(size_t i = 0; i < cap; i++)
+            cells_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+
+    ~MpmcRing() {
+        T value;
+        while(TryPop(value)) {
+        }
+        delete[] cells_;
+    }
+
+    MpmcRing(const MpmcRing&) = delete;
+    MpmcRing& operator=(const MpmcRing&) = delete;
+
+    size_t Capacity() const { return mask_ + 1; }
+
+    // 并发修改时只是近似值
+    size_t Size() const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    // 队列满时返回 false, 此时 value 不会被移走
+    bool TryPush(T&& value) {
+        Cell* cell;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq_.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+            if(diff == 0) {
+                if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0) {
+                return false;
+            }
+            else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->Ptr()) T(std::move(value));
+        cell->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空时返回 false
+    bool TryPop(T& value) {
+        Cell* cell;
+        size_t pos = head_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq_.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+            if(diff == 0) {
+                if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0) {
+                return false;
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+
+        T* slot = cell->Ptr();
+        value = std::move(*slot);
+        slot->~T();
+        cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // 每个槽位独占缓存行, 相邻槽位的读写不会互相干扰
+    struct alignas(64) Cell {
+        T* Ptr() { return reinterpret_cast<T*>(&storage_); }
+
+        std::atomic<size_t> seq_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    };
+
+    Cell* cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "ih_numa_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// 解析 "0-3,8-11" 形式的 cpu 列表
+void ParseCpuList(const char* list, std::vector<int>& cpus) {
+
+    const char* pos = list;
+    while(*pos) {
+        char* end = NULL;
+        long first = strtol(pos, &end, 10);
+        if(end == pos)
+            break;
+
+        long last = first;
+        pos = end;
+        if(*pos == '-') {
+            last = strtol(pos + 1, &end, 10);
+            pos = end;
+        }
+
+        for(long cpu = first; cpu <= last; cpu++)
+            cpus.push_back((int)cpu);
+
+        while(*pos == ',' || *pos == '\n' || *pos == ' ')
+            pos++;
+    }
+}
+}
+
+NumaThreadPool::NumaThreadPool() {
+
+    // 没有初始化成功时任务都交给它, 以 operation_canceled 丢弃
+    stopped_.Stop();
+}
+
+NumaThreadPool::~NumaThreadPool() {
+
+    Stop();
+}
+
+std::vector<std::vector<int> > NumaThreadPool::GetNodeCpus(std::vector<int>* nodeIds) {
+
+    std::vector<std::vector<int> > nodes;
+    if(nodeIds != NULL)
+        nodeIds->clear();
+#ifdef __linux__
+    // 节点号可能不连续(比如只有 node0 和 node2), 列目录而不是从 0 开始数
+    std::vector<int> ids;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if(dir == NULL)
+        return nodes;
+
+    while(struct dirent* entry = readdir(dir)) {
+        int id = -1;
+        char tail = 0;
+        if(sscanf(entry->d_name, "node%d%c", &id, &tail) == 1 && id >= 0)
+            ids.push_back(id);
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    for(size_t i = 0; i < ids.size(); i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+        FILE* fp = fopen(path, "r");
+        if(fp == NULL)
+            continue;
+
+        char line[1024] = {0};
+        if(fgets(line, sizeof(line), fp) == NULL)
+            line[0] = '\0';
+        fclose(fp);
+
+        std::vector<int> cpus;
+        ParseCpuList(line, cpus);
+        nodes.push_back(cpus);
+        if(nodeIds != NULL)
+            nodeIds->push_back(ids[i]);
+    }
+#else
+    (void)nodeIds;
+#endif
+    return nodes;
+}
+
+int NumaThreadPool::CurrentNode() {
+
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if(cpu >= 0 && (size_t)cpu < cpu_node_.size() && cpu_node_[cpu] >= 0)
+        return cpu_node_[cpu];
+#endif
+    for(size_t node = 0; node < node_index_.size(); node++) {
+        if(node_index_[node] == 0)
+            return (int)node;
+    }
+    return 0;
+}
+
+int NumaThreadPool::NodeOfAddress(const void* addr) {
+
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+    // MPOL_F_NODE | MPOL_F_ADDR: 返回 addr 所在页的节点, 不依赖 libnuma
+    const unsigned long kFlags = 1 | 2;
+    int node = -1;
+    if(syscall(SYS_get_mempolicy, &node, NULL, 0, addr, kFlags) == 0)
+        return node;
+#else
+    (void)addr;
+#endif
+    return -1;
+}
+
+bool NumaThreadPool::Init(size_t threadsPerNode, ThreadPool::ScheduleMode mode,
+                          bool pinEach) {
+
+    if(!pools_.empty())
+        return false;
+
+    std::vector<int> ids;
+    std::vector<std::vector<int> > nodes = GetNodeCpus(&ids);
+
+    // 读不到节点信息时当作单节点 0, 不绑核
+    if(nodes.empty()) {
+        nodes.push_back(std::vector<int>());
+        ids.push_back(0);
+    }
+
+    for(size_t index = 0; index < nodes.size(); index++) {
+        int id = ids[index];
+        if((size_t)id >= node_index_.size())
+            node_index_.resize(id + 1, -1);
+        node_index_[id] = (int)index;
+
+        for(size_t i = 0; i < nodes[index].size(); i++) {
+            int cpu = nodes[index][i];
+            if((size_t)cpu >= cpu_node_.size())
+                cpu_node_.resize(cpu + 1, -1);
+            cpu_node_[cpu] = id;
+        }
+
+        std::unique_ptr<ThreadPool> pool(new ThreadPool());
+        if(!pool->Init(threadsPerNode, mode)) {
+            Clear();
+            return false;
+        }
+        if(nodes.size() > 1)
+            pool->SetAffinity(nodes[index], pinEach);
+        pools_.push_back(std::move(pool));
+    }
+
+    return true;
+}
+
+void NumaThreadPool::Clear() {
+
+    for(size_t i = 0; i < pools_.size(); i++)
+        pools_[i]->Stop();
+    pools_.clear();
+    cpu_node_.clear();
+    node_index_.clear();
+}
+
+bool NumaThreadPool::Start() {
+
+    for(size_t i = 0; i < pools_.size(); i++) {
+        if(!pools_[i]->Start())
+            return false;
+    }
+    return true;
+}
+
+void NumaThreadPool::Stop() {
+
+    for(size_t i = 0; i < pools_.size(); i++)
+        pools_[i]->Stop();
+}
+
+bool NumaThreadPool::WaitForAllDone(int millsecond) {
+
+    if(millsecond < 0) {
+        for(size_t i = 0; i < pools_.size(); i++)
+            pools_[i]->WaitForAllDone(-1);
+        return true;
+    }
+
+    // 所有节点共用一个截止时间, 总的等待不超过 millsecond
+    int64_t deadline = getSteadyUs() + (int64_t)millsecond * 1000;
+    bool done = true;
+    for(size_t i = 0; i < pools_.size(); i++) {
+        int64_t left = deadline - getSteadyUs();
+        int wait = left > 0 ? (int)((left + 999) / 1000) : 0;
+        done = pools_[i]->WaitForAllDone(wait) && done;
+    }
+    return done;
+}
+
+ThreadPool& NumaThreadPool::GetPool(int node) {
+
+    if(pools_.empty())
+        return stopped_;
+    if(node < 0)
+        node = CurrentNode();
+    if((size_t)node < node_index_.size() && node_index_[node] >= 0)
+        return *pools_[node_index_[node]];
+    return *pools_[(size_t)node % pools_.size()];
+}
@@ -0,0 +1,61 @@
+#ifndef _IH_NUMA_POOL_H_
+#define _IH_NUMA_POOL_H_
+
+#include <memory>
+#include <vector>
+
+#include "ih_thread_pool.h"
+
+// 按 NUMA 节点拆分的线程池: 每个节点一个 ThreadPool, 线程绑定在该节点的 cpu 上.
+// 提交任务时指定节点(通常是连接缓冲区所在的节点), 任务就在访问本地内存的线程上执行.
+// 非 Linux 或读不到节点信息时退化为只有一个节点.
+class NumaThreadPool {
+
+public:
+    NumaThreadPool();
+    ~NumaThreadPool();
+
+    // 每个节点 threadsPerNode 个线程. pinEach 为 false 时线程可以在本节点的
+    // cpu 之间迁移, 为 true 时每个线程固定在一个 cpu 上
+    bool Init(size_t threadsPerNode,
+              ThreadPool::ScheduleMode mode = ThreadPool::SHARED_QUEUE,
+              bool pinEach = false);
+    bool Start();
+    void Stop();
+    // millsecond 是所有节点合计的等待时间
+    bool WaitForAllDone(int millsecond = -1);
+
+    size_t GetNodeNum() { return pools_.size(); }
+    // node 是内核的节点号(NodeOfAddress / CurrentNode 的返回值), 小于 0 时取当前线程
+    // 所在节点. 节点号不一定连续, 按 Init 时记下的映射找到对应的池, 不存在的节点取模.
+    // 没有 Init 或 Init 失败时返回一个已经 Stop 的池, 提交的任务以 operation_canceled 丢弃
+    ThreadPool& GetPool(int node);
+
+    template <class F, class... Args>
+    auto Exec(int node, F &&f, Args &&... args) -> std::future<decltype(f(args...))> {
+        return GetPool(node).Exec(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Post(int node, F &&f, Args &&... args) -> decltype(void(f(args...))) {
+        GetPool(node).Post(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // 各节点的 cpu 列表, 来自 /sys/devices/system/node/node*/cpulist, 按节点号从小到大;
+    // nodeIds 不为空时返回对应的内核节点号
+    static std::vector<std::vector<int> > GetNodeCpus(std::vector<int>* nodeIds = NULL);
+    // 当前线程正在运行的 cpu 所属的节点号, 未知时返回第一个节点
+    int CurrentNode();
+    // 地址所在物理页所属的节点(页必须已经分配), 未知时返回 -1
+    static int NodeOfAddress(const void* addr);
+
+private:
+    void Clear();
+
+    std::vector<std::unique_ptr<ThreadPool> > pools_;
+    std::vector<int> cpu_node_;     // cpu 编号 -> 内核节点号
+    std::vector<int> node_index_;   // 内核节点号 -> pools_ 下标, 没有的节点为 -1
+    ThreadPool stopped_;            // pools_ 为空时的 GetPool 返回值
+};
+
+#endif
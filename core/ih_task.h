@@ -0,0 +1,273 @@
+#ifndef _IH_TASK_H_
+#define _IH_TASK_H_
+
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+// 线程池任务的存储: 定长内联缓冲区的类型擦除可调用对象, 以及可复用内存的环形队列.
+// 二者配合后, 小任务在稳定状态下的提交和执行都不需要堆分配.
+
+struct InlineTaskOps {
+    void (*invoke)(void* storage);
+    void (*cancel)(void* storage, std::errc code);
+    void (*move)(void* from, void* to);
+    void (*destroy)(void* storage);
+};
+
+// 任务未被执行就被丢弃时调用可调用对象的 Cancel(code), 没有该成员的什么都不做
+template <class Fn>
+auto CancelTask(Fn& fn, std::errc code, int) -> decltype(fn.Cancel(code), void()) {
+    fn.Cancel(code);
+}
+
+template <class Fn>
+void CancelTask(Fn&, std::errc, long) {}
+
+// Exec 提交的任务: 执行时设置 promise 的值, 被丢弃时以 std::system_error(code) 完成 future
+template <class R, class Fn>
+struct PromiseTask {
+    PromiseTask(Fn&& fn) : _fn(std::move(fn)) {}
+
+    void operator()() {
+        try {
+            _promise.set_value(_fn());
+        }
+        catch(...) {
+            _promise.set_exception(std::current_exception());
+        }
+    }
+
+    void Cancel(std::errc code) {
+        _promise.set_exception(std::make_exception_ptr(
+            std::system_error(std::make_error_code(code))));
+    }
+
+    Fn _fn;
+    std::promise<R> _promise;
+};
+
+template <class Fn>
+struct PromiseTask<void, Fn> {
+    PromiseTask(Fn&& fn) : _fn(std::move(fn)) {}
+
+    void operator()() {
+        try {
+            _fn();
+            _promise.set_value();
+        }
+        catch(...) {
+            _promise.set_exception(std::current_exception());
+        }
+    }
+
+    void Cancel(std::errc code) {
+        _promise.set_exception(std::make_exception_ptr(
+            std::system_error(std::make_error_code(code))));
+    }
+
+    Fn _fn;
+    std::promise<void> _promise;
+};
+
+// 带丢弃回调的任务: 先让内层任务完成自己的 future, 再调用 onExpire
+template <class Task, class OnExpire>
+struct ExpirableTask {
+    ExpirableTask(Task&& task, OnExpire&& onExpire)
+        : _task(std::move(task)), _onExpire(std::move(onExpire)) {}
+
+    void operator()() { _task(); }
+
+    void Cancel(std::errc code) {
+        CancelTask(_task, code, 0);
+        _onExpire();
+    }
+
+    Task _task;
+    OnExpire _onExpire;
+};
+
+// 只能移动的 void() 可调用对象. 不超过 Capacity 字节且移动不抛异常的可调用对象
+// 直接构造在内部缓冲区里, 否则退化为在堆上分配一次.
+template <size_t Capacity>
+class InlineTask {
+
+public:
+    template <class F>
+    struct IsInline {
+        static const bool value = sizeof(F) <= Capacity &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value;
+    };
+
+    InlineTask() : ops_(NULL) {}
+
+    template <class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, InlineTask>::value>::type>
+    InlineTask(F&& f) : ops_(NULL) {
+        Assign(std::forward<F>(f));
+    }
+
+    InlineTask(InlineTask&& other) noexcept : ops_(other.ops_) {
+        if(ops_) {
+            ops_->move(other.storage_, storage_);
+            other.ops_ = NULL;
+        }
+    }
+
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if(this != &other) {
+            Reset();
+            ops_ = other.ops_;
+            if(ops_) {
+                ops_->move(other.storage_, storage_);
+                other.ops_ = NULL;
+            }
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() { Reset(); }
+
+    template <class F>
+    void Assign(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        Reset();
+        if constexpr(IsInline<Fn>::value) {
+            new (storage_) Fn(std::forward<F>(f));
+            ops_ = &LocalOps<Fn>::ops;
+        }
+        else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+            ops_ = &HeapOps<Fn>::ops;
+        }
+    }
+
+    void Reset() {
+        if(ops_) {
+            ops_->destroy(storage_);
+            ops_ = NULL;
+        }
+    }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    // 不执行任务, 通知它被丢弃的原因(超时, 拒绝...)
+    void Cancel(std::errc code) { ops_->cancel(storage_, code); }
+
+    explicit operator bool() const { return ops_ != NULL; }
+
+private:
+    template <class Fn>
+    struct LocalOps {
+        static void Invoke(void* p) { (*static_cast<Fn*>(p))(); }
+        static void Cancel(void* p, std::errc code) {
+            CancelTask(*static_cast<Fn*>(p), code, 0);
+        }
+        static void Move(void* from, void* to) {
+            new (to) Fn(std::move(*static_cast<Fn*>(from)));
+            static_cast<Fn*>(from)->~Fn();
+        }
+        static void Destroy(void* p) { static_cast<Fn*>(p)->~Fn(); }
+        static constexpr InlineTaskOps ops = {&Invoke, &Cancel, &Move, &Destroy};
+    };
+
+    template <class Fn>
+    struct HeapOps {
+        static Fn*& Ptr(void* p) { return *static_cast<Fn**>(p); }
+        static void Invoke(void* p) { (*Ptr(p))(); }
+        static void Cancel(void* p, std::errc code) { CancelTask(*Ptr(p), code, 0); }
+        static void Move(void* from, void* to) {
+            *static_cast<Fn**>(to) = Ptr(from);
+            Ptr(from) = NULL;
+        }
+        static void Destroy(void* p) { delete Ptr(p); }
+        static constexpr InlineTaskOps ops = {&Invoke, &Cancel, &Move, &Destroy};
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity < sizeof(void*) ? sizeof(void*) : Capacity];
+    const InlineTaskOps* ops_;
+};
+
+// 容量按 2 的幂增长且从不收缩的环形队列, 两端都可以弹出.
+// 元素在扩容时被移动, 因此 T 的移动构造不能抛异常.
+template <class T>
+class TaskRing {
+
+public:
+    TaskRing() : buf_(NULL), mask_(0), head_(0), size_(0) {}
+    ~TaskRing() {
+        Clear();
+        ::operator delete(buf_);
+    }
+
+    TaskRing(const TaskRing&) = delete;
+    TaskRing& operator=(const TaskRing&) = delete;
+
+    bool Empty() const { return size_ == 0; }
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return buf_ ? mask_ + 1 : 0; }
+
+    T& Front() { return buf_[head_]; }
+    T& Back() { return buf_[(head_ + size_ - 1) & mask_]; }
+
+    void PushBack(T&& value) {
+        if(size_ == Capacity())
+            Grow(size_ == 0 ? 16 : size_ * 2);
+        new (&buf_[(head_ + size_) & mask_]) T(std::move(value));
+        ++size_;
+    }
+
+    void PopFront() {
+        buf_[head_].~T();
+        head_ = (head_ + 1) & mask_;
+        --size_;
+    }
+
+    void PopBack() {
+        Back().~T();
+        --size_;
+    }
+
+    void Reserve(size_t num) {
+        size_t cap = Capacity() == 0 ? 16 : Capacity();
+        while(cap < num)
+            cap *= 2;
+        if(cap > Capacity())
+            Grow(cap);
+    }
+
+    void Clear() {
+        while(size_ > 0)
+            PopFront();
+        head_ = 0;
+    }
+
+private:
+    void Grow(size_t cap) {
+        T* buf = static_cast<T*>(::operator new(cap * sizeof(T)));
+        for(size_t i = 0; i < size_; i++) {
+            T& old = buf_[(head_ + i) & mask_];
+            new (&buf[i]) T(std::move(old));
+            old.~T();
+        }
+        ::operator delete(buf_);
+        buf_ = buf;
+        mask_ = cap - 1;
+        head_ = 0;
+    }
+
+    T* buf_;
+    size_t mask_;
+    size_t head_;
+    size_t size_;
+};
+
+#endif
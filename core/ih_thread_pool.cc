@@ -1,21 +1,155 @@
 #include "ih_thread_pool.h"
 
-ThreadPool::ThreadPool() : thread_num_(1), terminate_(false) {}
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <time.h>
+
+namespace {
+// 无锁模式下空闲线程挂起前自旋尝试出队的次数, 单核机器上自旋没有意义
+const int kSpinCount = 64;
+const int kSpinLimit = std::thread::hardware_concurrency() > 1 ? kSpinCount : 0;
+
+// 工作线程记录自己所属的线程池和下标, 用于把本线程提交的任务放进自己的队列
+thread_local ThreadPool* tls_pool = NULL;
+thread_local int tls_index = -1;
+}
+
+bool ThreadPool::TaskQueue::Later(const TaskFunc& a, const TaskFunc& b) {
+
+    if(a._expireTime != b._expireTime)
+        return a._expireTime > b._expireTime;
+    return a._seq > b._seq;
+}
+
+void ThreadPool::TaskQueue::Push(TaskFunc&& task) {
+
+    if(task._expireTime == 0) {
+        // 出队时要和堆顶比较等待时间, 没开统计时这里补上入队时刻
+        if(task._enqueueTime == 0)
+            task._enqueueTime = getSteadyUs();
+        fifo_.PushBack(std::move(task));
+        return;
+    }
+
+    task._seq = ++seq_;
+    timed_.push_back(std::move(task));
+    std::push_heap(timed_.begin(), timed_.end(), Later);
+}
+
+void ThreadPool::TaskQueue::Pop(TaskFunc& task) {
+
+    bool edf = !timed_.empty();
+    if(edf && !fifo_.Empty()) {
+        int64_t waited = (getSteadyUs() - fifo_.Front()._enqueueTime) / 1000;
+        edf = timed_.front()._expireTime <= TNOWMS - waited + kFifoSlackMs;
+    }
+
+    if(edf) {
+        std::pop_heap(timed_.begin(), timed_.end(), Later);
+        task = std::move(timed_.back());
+        timed_.pop_back();
+        return;
+    }
+
+    task = std::move(fifo_.Front());
+    fifo_.PopFront();
+}
+
+void ThreadPool::TaskQueue::PopOldest(TaskFunc& task) {
+
+    // 先进先出队列的头部等待得最久; 只剩带超时的任务时丢弃最快超时的那个
+    if(!fifo_.Empty()) {
+        task = std::move(fifo_.Front());
+        fifo_.PopFront();
+        return;
+    }
+
+    std::pop_heap(timed_.begin(), timed_.end(), Later);
+    task = std::move(timed_.back());
+    timed_.pop_back();
+}
+
+ThreadPool::ThreadPool()
+    : thread_num_(1), mode_(SHARED_QUEUE), terminate_(false), policy_(OVERFLOW_BLOCK) {
+
+    std::vector<uint32_t> weights;
+    weights.push_back(8);
+    weights.push_back(4);
+    weights.push_back(1);
+    SetLanes(weights);
+
+    external_stats_.reset(new WorkerStats());
+    label_names_.push_back("default");
+}
+
+ThreadPool::WorkerStats::WorkerStats() {
+
+    // 未标记的任务最常见, 预先分配, 其余标签用到时再分配
+    labels_[0].store(new LabelHistograms(), std::memory_order_relaxed);
+    for(uint32_t i = 1; i < kMaxLabels; i++)
+        labels_[i].store(NULL, std::memory_order_relaxed);
+}
+
+ThreadPool::WorkerStats::~WorkerStats() {
+
+    for(uint32_t i = 0; i < kMaxLabels; i++)
+        delete labels_[i].load(std::memory_order_relaxed);
+}
+
+ThreadPool::LabelHistograms* ThreadPool::WorkerStats::Get(uint32_t label) {
+
+    if(label >= kMaxLabels)
+        label = 0;
+
+    LabelHistograms* hist = labels_[label].load(std::memory_order_acquire);
+    if(hist != NULL)
+        return hist;
+
+    // 正常只有本线程会创建; external_stats_ 可能被多个提交线程同时创建, 用 CAS 发布
+    LabelHistograms* created = new LabelHistograms();
+    if(labels_[label].compare_exchange_strong(hist, created, std::memory_order_acq_rel))
+        return created;
+
+    delete created;
+    return hist;
+}
 
 ThreadPool::~ThreadPool() {
 
     Stop();
 }
 
-bool ThreadPool::Init(size_t num) {
-    
+bool ThreadPool::Init(size_t num, ScheduleMode mode) {
+
 
     std::unique_lock<std::mutex> lock(mutex_);
 
-    if(!threads_.empty())
+    if(!threads_.empty() || pending_ != 0)
         return false;
 
     thread_num_ = num;
+    mode_ = mode;
+    if(mode_ != SHARED_QUEUE)
+        elastic_ = false;
+
+    workers_.clear();
+    if(mode_ == WORK_STEALING) {
+        for(size_t i = 0; i < thread_num_; i++)
+            workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+
+    ring_.reset();
+    if(mode_ == LOCK_FREE) {
+        size_t size = capacity_;
+        if(size == 0)
+            size = kRingSize;
+        ring_.reset(new MpmcRing<TaskFunc>(size));
+        capacity_ = ring_->Capacity();
+    }
     return true;
 }
 
@@ -25,10 +159,19 @@ void ThreadPool::Stop() {
         std::unique_lock<std::mutex> lock(mutex_);
         terminate_ = true;
         condition_.notify_all();
+        not_full_.notify_all();
     }
-    
 
-    for(int i = 0; i < threads_.size(); i++) {
+    ++task_seq_;
+    FutexWakeAll(&task_seq_);
+    ++space_seq_;
+    FutexWakeAll(&space_seq_);
+
+
+    for(size_t i = 0; i < threads_.size(); i++) {
+
+        if(threads_[i] == NULL)
+            continue;
 
         if(threads_[i]->joinable())
             threads_[i]->join();
@@ -37,20 +180,148 @@ void ThreadPool::Stop() {
         threads_[i] = NULL;
     }
 
+    // 工作线程都已退出, 取出还在排队的任务, 解锁后以 operation_canceled 完成,
+    // 否则 future 一直挂着, pending_ 不归零, 之后也无法重新 Init
+    std::vector<TaskFunc> queued;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        threads_.clear();
+        retired_.clear();
+        live_threads_ = 0;
+
+        TaskFunc task;
+        while(PopShared(task))
+            queued.push_back(std::move(task));
+    }
+
+    for(size_t i = 0; i < workers_.size(); i++) {
+        Worker* worker = workers_[i].get();
+        std::unique_lock<std::mutex> lock(worker->mutex_);
+        while(!worker->tasks_.Empty()) {
+            queued.push_back(std::move(worker->tasks_.Front()));
+            worker->tasks_.PopFront();
+        }
+    }
+
+    if(ring_) {
+        TaskFunc task;
+        while(ring_->TryPop(task))
+            queued.push_back(std::move(task));
+    }
+
+    for(size_t i = 0; i < queued.size(); i++) {
+        --pending_;
+        try {
+            queued[i]._func.Cancel(std::errc::operation_canceled);
+        }
+        catch(...) {
+        }
+    }
+
     std::unique_lock<std::mutex> lock(mutex_);
-    threads_.clear();
+    if(IsAllDone())
+        done_condition_.notify_all();
 }
 
 size_t ThreadPool::GetThreadNum() {
 
+    return live_threads_;
+}
+
+bool ThreadPool::SetElastic(size_t minThreads, size_t maxThreads,
+                            int64_t targetWaitMs, int64_t lingerMs) {
+
     std::unique_lock<std::mutex> lock(mutex_);
-    return threads_.size();
+    if(!threads_.empty() || mode_ != SHARED_QUEUE)
+        return false;
+
+    if(minThreads == 0 || maxThreads < minThreads || targetWaitMs <= 0 || lingerMs <= 0)
+        return false;
+
+    elastic_ = true;
+    min_threads_ = minThreads;
+    max_threads_ = maxThreads;
+    target_wait_us_ = targetWaitMs * 1000;
+    linger_ms_ = lingerMs;
+    return true;
 }
 
-size_t ThreadPool::GetJobNum() {
+bool ThreadPool::SetAffinity(const std::vector<int>& cpus, bool pinEach) {
 
     std::unique_lock<std::mutex> lock(mutex_);
-    return tasks_.size();
+    if(!threads_.empty())
+        return false;
+
+    cpus_ = cpus;
+    pin_each_ = pinEach;
+    return true;
+}
+
+void ThreadPool::ApplyAffinity(size_t index) {
+
+#ifdef __linux__
+    if(cpus_.empty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(pin_each_) {
+        CPU_SET(cpus_[index % cpus_.size()], &set);
+    }
+    else {
+        for(size_t i = 0; i < cpus_.size(); i++)
+            CPU_SET(cpus_[i], &set);
+    }
+
+    // 绑定失败(比如 cpu 不在进程的 cpuset 里)时保持默认调度, 不影响线程工作
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+void ThreadPool::SpawnThread() {
+
+    // 复用已退出线程的下标, 先把它 join 掉(线程已经离开 Run, 不会阻塞很久)
+    size_t index = threads_.size();
+    if(!retired_.empty()) {
+        index = retired_.back();
+        retired_.pop_back();
+        if(threads_[index]->joinable())
+            threads_[index]->join();
+        delete threads_[index];
+        threads_[index] = NULL;
+    }
+    else {
+        threads_.push_back(NULL);
+    }
+
+    ++live_threads_;
+    threads_[index] = new std::thread(&ThreadPool::Run, this, index);
+}
+
+void ThreadPool::MaybeGrow(int64_t now) {
+
+    // 调用者持有 mutex_. 排队时间持续高于目标且没有空闲线程时加一个线程,
+    // 两次扩容至少间隔一个目标等待时间, 给新线程留出消化积压的时间
+    if(!elastic_ || terminate_ || idle_ > 0 || live_threads_ >= max_threads_)
+        return;
+
+    if(now - last_grow_us_ < target_wait_us_)
+        return;
+
+    // 所有线程都卡住(比如都在等数据库)时不会再有出队, 用距离上次出队的时间兜底
+    bool stalled = pending_ > 0 && now - last_dequeue_us_ > target_wait_us_;
+    if(wait_ewma_us_ <= target_wait_us_ && !stalled)
+        return;
+
+    last_grow_us_ = now;
+    SpawnThread();
+}
+
+size_t ThreadPool::GetJobNum() {
+
+    return pending_;
 }
 
 bool ThreadPool::Start() {
@@ -59,72 +330,625 @@ bool ThreadPool::Start() {
     if(!threads_.empty())
         return false;
 
-    for(size_t i = 0; i < thread_num_; i++) {
-        threads_.push_back(new std::thread(&ThreadPool::Run, this));
+    terminate_ = false;
+
+    size_t slots = elastic_ ? max_threads_ : thread_num_;
+    while(stats_.size() < slots)
+        stats_.push_back(std::unique_ptr<WorkerStats>(new WorkerStats()));
+
+    size_t num = elastic_ ? min_threads_ : thread_num_;
+    for(size_t i = 0; i < num; i++) {
+        SpawnThread();
     }
 
+    last_dequeue_us_ = getSteadyUs();
     return true;
 }
 
-void ThreadPool::Run() {
+int ThreadPool::CurrentWorker() {
 
-    while(!IsTerminate) {
-        TaskFuncPtr task;
-        bool ok = Get(task);
-        if(ok) {
-            ++atomic_;
-            try{
-                if(task->_expireTime != 0 && task->_expireTime < TNOWMS) {
-                    //超时任务处理
-                }
-                else {
-                    task->_func();
+    return tls_pool == this ? tls_index : -1;
+}
+
+void ThreadPool::Push(TaskFunc&& task) {
+
+    // Stop 之后不再入队, 否则 future 和 Then 的后续步骤要一直挂到线程池析构
+    if(terminate_) {
+        Drop(task);
+        return;
+    }
+
+    if(stats_enabled_ || elastic_)
+        task._enqueueTime = getSteadyUs();
+
+    if(mode_ == WORK_STEALING && !workers_.empty()) {
+        PushStealing(std::move(task));
+        return;
+    }
+
+    if(mode_ == LOCK_FREE) {
+        PushLockFree(std::move(task));
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(capacity_ != 0 && pending_ >= capacity_) {
+        switch(policy_) {
+        case OVERFLOW_BLOCK:
+            ++blocked_;
+            not_full_.wait(lock, [this]{
+                return terminate_ || pending_ < capacity_;
+            });
+            --blocked_;
+            if(terminate_) {
+                lock.unlock();
+                task._func.Cancel(std::errc::operation_canceled);
+                return;
+            }
+            break;
+        case OVERFLOW_REJECT:
+            lock.unlock();
+            Reject(task);
+            return;
+        case OVERFLOW_DROP_OLDEST: {
+            TaskFunc oldest;
+            PopOldestShared(oldest);
+            lanes_[std::min<size_t>(task._lane, lanes_.size() - 1)]->Push(std::move(task));
+            condition_.notify_one();
+            lock.unlock();
+            Drop(oldest);
+            return;
+        }
+        case OVERFLOW_CALLER_RUNS:
+            lock.unlock();
+            ExecuteAndRecord(task, stats_enabled_ ? external_stats_.get() : NULL, true);
+            return;
+        }
+    }
+
+    if(elastic_)
+        MaybeGrow(task._enqueueTime);
+
+    lanes_[std::min<size_t>(task._lane, lanes_.size() - 1)]->Push(std::move(task));
+    UpdateHighWater(++pending_);
+    condition_.notify_one();
+}
+
+void ThreadPool::PushStealing(TaskFunc&& task) {
+
+    // 工作线程提交的任务放入自己的队列, 外部线程提交的任务轮询分发
+    int self = CurrentWorker();
+    size_t index = self >= 0 ? (size_t)self : next_worker_++ % workers_.size();
+    Worker* worker = workers_[index].get();
+
+    // 各线程队列没有全局锁, 容量检查是近似的, 并发提交时可能略微超出
+    if(capacity_ != 0 && pending_ >= capacity_) {
+        switch(policy_) {
+        case OVERFLOW_BLOCK: {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++blocked_;
+            not_full_.wait(lock, [this]{
+                return terminate_ || pending_ < capacity_;
+            });
+            --blocked_;
+            if(terminate_) {
+                lock.unlock();
+                task._func.Cancel(std::errc::operation_canceled);
+                return;
+            }
+            break;
+        }
+        case OVERFLOW_REJECT:
+            Reject(task);
+            return;
+        case OVERFLOW_DROP_OLDEST: {
+            TaskFunc oldest;
+            size_t depth = ++pending_;
+            {
+                std::unique_lock<std::mutex> lock(worker->mutex_);
+                if(!worker->tasks_.Empty()) {
+                    oldest = std::move(worker->tasks_.Front());
+                    worker->tasks_.PopFront();
                 }
+                worker->tasks_.PushBack(std::move(task));
             }
-            catch(...) {
+            if(oldest._func) {
+                --pending_;
+                Drop(oldest);
+                return;
             }
+            // 目标队列是空的, 相当于直接入队
+            UpdateHighWater(depth);
+            NotifyIdle();
+            return;
+        }
+        case OVERFLOW_CALLER_RUNS:
+            ExecuteAndRecord(task, stats_enabled_ ? external_stats_.get() : NULL, true);
+            return;
+        }
+    }
+
+    // 先加计数再入队, 否则任务可能在加计数之前就被偷走, 计数短暂变成负数
+    size_t depth = ++pending_;
+    {
+        std::unique_lock<std::mutex> lock(worker->mutex_);
+        worker->tasks_.PushBack(std::move(task));
+    }
+    UpdateHighWater(depth);
+    NotifyIdle();
+}
+
+void ThreadPool::PushLockFree(TaskFunc&& task) {
+
+    // 先占用计数再入队, 出队方减计数时不会减到负数
+    ++pending_;
+    while(!ring_->TryPush(std::move(task))) {
+        switch(policy_) {
+        case OVERFLOW_BLOCK: {
+            uint32_t seq = space_seq_.load(std::memory_order_acquire);
+            ++blocked_;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool pushed = ring_->TryPush(std::move(task));
+            if(!pushed && !terminate_)
+                FutexWait(&space_seq_, seq);
+            --blocked_;
+            if(pushed)
+                break;
+            if(terminate_) {
+                --pending_;
+                task._func.Cancel(std::errc::operation_canceled);
+                return;
+            }
+            continue;
+        }
+        case OVERFLOW_REJECT:
+            --pending_;
+            Reject(task);
+            return;
+        case OVERFLOW_DROP_OLDEST: {
+            // 环形队列先进先出, 队头就是最老的任务
+            TaskFunc oldest;
+            if(ring_->TryPop(oldest)) {
+                --pending_;
+                Drop(oldest);
+            }
+            continue;
+        }
+        case OVERFLOW_CALLER_RUNS:
+            --pending_;
+            ExecuteAndRecord(task, stats_enabled_ ? external_stats_.get() : NULL, true);
+            return;
+        }
+        break;
+    }
+
+    // pending_ 含阻塞中的提交, 高水位按队列实际长度算
+    UpdateHighWater(ring_->Size());
+    WakeLockFree();
+}
+
+void ThreadPool::WakeLockFree() {
+
+    // 和 GetLockFree 里 ++idle_ 之后的重试配对: 要么这里看到挂起的线程,
+    // 要么对方挂起前能取到刚入队的任务
+    // 已经有线程被唤醒还没开始取任务时不再叫醒别的线程, 由它取到任务后接力唤醒,
+    // 突发提交时不会一个任务一次系统调用地把所有线程都叫起来
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(idle_ > 0 && !waking_.load(std::memory_order_relaxed) && !waking_.exchange(true)) {
+        ++task_seq_;
+        FutexWake(&task_seq_, 1);
+    }
+}
+
+void ThreadPool::NotifyIdle() {
+
+    // 只有存在挂起线程时才需要碰全局锁
+    if(idle_ > 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.notify_one();
+    }
+}
+
+void ThreadPool::NotifyNotFull() {
+
+    if(blocked_ > 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.notify_one();
+    }
+}
+
+void ThreadPool::UpdateHighWater(size_t depth) {
+
+    size_t high = high_water_.load(std::memory_order_relaxed);
+    while(depth > high &&
+          !high_water_.compare_exchange_weak(high, depth, std::memory_order_relaxed)) {
+    }
+}
+
+void ThreadPool::Reject(TaskFunc& task) {
+
+    ++rejected_num_;
+    try {
+        task._func.Cancel(std::errc::resource_unavailable_try_again);
+    }
+    catch(...) {
+    }
+}
+
+void ThreadPool::Drop(TaskFunc& task) {
+
+    ++dropped_num_;
+    try {
+        task._func.Cancel(std::errc::operation_canceled);
+    }
+    catch(...) {
+    }
+}
+
+bool ThreadPool::SetLanes(const std::vector<uint32_t>& weights) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(weights.empty() || (!lanes_.empty() && mode_ == SHARED_QUEUE && pending_ != 0))
+        return false;
+
+    lanes_.clear();
+    lane_weight_.clear();
+    for(size_t i = 0; i < weights.size(); i++) {
+        lanes_.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+        lane_weight_.push_back(weights[i] == 0 ? 1 : weights[i]);
+    }
+    lane_credit_ = lane_weight_;
+    return true;
+}
+
+bool ThreadPool::PopShared(TaskFunc& task) {
+
+    // 每次都从最高优先级的通道找起, 高优先级任务不用等低优先级通道用完配额
+    for(int round = 0; round < 2; round++) {
+        for(size_t lane = 0; lane < lanes_.size(); lane++) {
+            if(lane_credit_[lane] == 0 || lanes_[lane]->Empty())
+                continue;
+
+            --lane_credit_[lane];
+            lanes_[lane]->Pop(task);
+            return true;
+        }
+
+        // 有任务的通道本轮配额都已用完, 开始新的一轮
+        lane_credit_ = lane_weight_;
+    }
+
+    return false;
+}
+
+bool ThreadPool::PopOldestShared(TaskFunc& task) {
+
+    // 从优先级最低的非空通道里挤掉等待最久的任务
+    for(size_t i = lanes_.size(); i > 0; i--) {
+        if(!lanes_[i - 1]->Empty()) {
+            lanes_[i - 1]->PopOldest(task);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::SetCapacity(size_t capacity, OverflowPolicy policy) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(mode_ == LOCK_FREE) {
+        size_t size = capacity;
+        if(size == 0)
+            size = kRingSize;
+        if(size > ring_->Capacity() || size <= ring_->Capacity() / 2) {
+            if(!threads_.empty() || pending_ != 0)
+                return false;
+            ring_.reset(new MpmcRing<TaskFunc>(size));
+        }
+        capacity_ = ring_->Capacity();
+        policy_ = policy;
+        return true;
+    }
+
+    capacity_ = capacity;
+    policy_ = policy;
+    not_full_.notify_all();
+    return true;
+}
+
+void ThreadPool::Run(size_t index) {
+
+    tls_pool = this;
+    tls_index = (int)index;
+    ApplyAffinity(index);
+
+    while(!IsTerminate()) {
+        TaskFunc task;
+        bool retire = false;
+        bool ok = Get(index, task, retire);
+        if(retire)
+            break;
+        if(ok) {
+            ExecuteAndRecord(task, stats_enabled_ ? stats_[index].get() : NULL, false);
 
             --atomic_;
 
-            std::unique_lock<std::mutex> lock(mutex_);
-            if(atomic_ == 0 && tasks_.empty())
-                condition_.notify_all();
+            if(IsAllDone()) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                done_condition_.notify_all();
+            }
         }
     }
+
+    tls_pool = NULL;
+    tls_index = -1;
+}
+
+bool ThreadPool::Execute(TaskFunc& task) {
+
+    bool ran = false;
+    try{
+        if(task._expireTime != 0 && task._expireTime < TNOWMS) {
+            Expire(task);
+        }
+        else {
+            ran = true;
+            task._func();
+        }
+    }
+    catch(...) {
+    }
+    return ran;
+}
+
+void ThreadPool::ExecuteAndRecord(TaskFunc& task, WorkerStats* stats, bool shared) {
+
+    if(stats == NULL) {
+        Execute(task);
+        return;
+    }
+
+    int64_t start = getSteadyUs();
+    bool ran = Execute(task);
+    int64_t end = getSteadyUs();
+
+    LabelHistograms* hist = stats->Get(task._label);
+    uint64_t wait = task._enqueueTime != 0 && start > task._enqueueTime ? start - task._enqueueTime : 0;
+    uint64_t run = end > start ? end - start : 0;
+    std::atomic<uint64_t>& counter = ran ? stats->executed_ : stats->expired_;
+
+    if(shared) {
+        hist->wait_.RecordShared(wait);
+        if(ran)
+            hist->run_.RecordShared(run);
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        hist->wait_.Record(wait);
+        if(ran)
+            hist->run_.Record(run);
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+uint32_t ThreadPool::RegisterLabel(const std::string& name) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(size_t i = 0; i < label_names_.size(); i++) {
+        if(label_names_[i] == name)
+            return (uint32_t)i;
+    }
+
+    if(label_names_.size() >= WorkerStats::kMaxLabels)
+        return 0;
+
+    label_names_.push_back(name);
+    return (uint32_t)(label_names_.size() - 1);
+}
+
+ThreadPool::Stats ThreadPool::GetStats() {
+
+    // mutex_ 只保护 stats_ 数组本身(Start 时可能扩容), 工作线程记录统计不拿这把锁
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    Stats stats;
+    stats._labels.resize(label_names_.size());
+    for(size_t i = 0; i < label_names_.size(); i++)
+        stats._labels[i]._name = label_names_[i];
+
+    std::vector<WorkerStats*> slots;
+    for(size_t i = 0; i < stats_.size(); i++)
+        slots.push_back(stats_[i].get());
+    slots.push_back(external_stats_.get());
+
+    for(size_t i = 0; i < slots.size(); i++) {
+        stats._executed += slots[i]->executed_.load(std::memory_order_relaxed);
+        stats._expired += slots[i]->expired_.load(std::memory_order_relaxed);
+        for(size_t label = 0; label < stats._labels.size(); label++) {
+            LabelHistograms* hist = slots[i]->labels_[label].load(std::memory_order_acquire);
+            if(hist == NULL)
+                continue;
+            hist->wait_.AddTo(stats._labels[label]._wait);
+            hist->run_.AddTo(stats._labels[label]._run);
+        }
+    }
+
+    return stats;
+}
+
+void ThreadPool::Expire(TaskFunc& task) {
+
+    //超时任务处理: 完成 future 并调用 onExpire, 不再执行任务本身
+    ++expired_num_;
+    task._func.Cancel(std::errc::timed_out);
 }
 
 bool ThreadPool::WaitForAllDone(int millsecond) {
 
     std::unique_lock<std::mutex> lock(mutex_);
-    if(tasks_.empty())
+    if(IsAllDone())
         return true;
 
     if(millsecond < 0) {
-        condition_.wait(lock, [this]{return tasks_.empty();});
+        done_condition_.wait(lock, [this]{return IsAllDone();});
         return true;
     }
     else {
-        return condition_.wait_for(lock, std::chrono::milliseconds(millsecond),
-            [this]{return tasks_.empty();});
+        return done_condition_.wait_for(lock, std::chrono::milliseconds(millsecond),
+            [this]{return IsAllDone();});
     }
 }
 
-bool ThreadPool::Get(TaskFuncPtr& task) {
+bool ThreadPool::GetLocal(size_t index, TaskFunc& task) {
+
+    Worker* worker = workers_[index].get();
+    std::unique_lock<std::mutex> lock(worker->mutex_);
+    if(worker->tasks_.Empty())
+        return false;
+
+    // 自己的队列后进先出, 刚提交的任务数据还在缓存里
+    task = std::move(worker->tasks_.Back());
+    worker->tasks_.PopBack();
+    lock.unlock();
+    ++atomic_;
+    --pending_;
+    NotifyNotFull();
+    return true;
+}
+
+bool ThreadPool::Steal(size_t index, TaskFunc& task) {
+
+    size_t num = workers_.size();
+    for(size_t i = 1; i < num; i++) {
+        Worker* victim = workers_[(index + i) % num].get();
+        std::unique_lock<std::mutex> lock(victim->mutex_, std::try_to_lock);
+        if(!lock.owns_lock() || victim->tasks_.Empty())
+            continue;
+
+        // 从别人队列的头部偷最早提交的任务
+        task = std::move(victim->tasks_.Front());
+        victim->tasks_.PopFront();
+        lock.unlock();
+        ++atomic_;
+        --pending_;
+        NotifyNotFull();
+        return true;
+    }
+
+    return false;
+}
+
+bool ThreadPool::GetLockFree(TaskFunc& task) {
+
+    while(!terminate_) {
+        // 任务密集时先自旋一会, 不用每次都进内核
+        bool ok = false;
+        for(int i = 0; i < kSpinLimit && !ok; i++) {
+            ok = ring_->TryPop(task);
+            if(!ok)
+                CpuRelax();
+        }
+
+        if(!ok) {
+            uint32_t seq = task_seq_.load(std::memory_order_acquire);
+            ++idle_;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            ok = ring_->TryPop(task);
+            // 唤醒标记可能没人认领(比如被叫醒前对方自己取到了任务), 这时由本线程认领,
+            // 先不睡, 回去重新取一次
+            if(!ok && !terminate_ && !waking_.exchange(false)) {
+                FutexWait(&task_seq_, seq);
+                // 交还唤醒标记, 提交方才能继续叫醒别的线程
+                waking_ = false;
+            }
+            --idle_;
+        }
+
+        if(ok) {
+            ++atomic_;
+            --pending_;
+            // 还有积压就接力唤醒下一个空闲线程
+            if(ring_->Size() > 0)
+                WakeLockFree();
+            // 队列腾出一半再一起唤醒阻塞的提交线程, 不在每次出队时都做系统调用
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(blocked_ > 0 && ring_->Size() <= ring_->Capacity() / 2) {
+                ++space_seq_;
+                FutexWakeAll(&space_seq_);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::Get(size_t index, TaskFunc& task, bool& retire) {
+
+    if(mode_ == LOCK_FREE)
+        return GetLockFree(task);
+
+    if(mode_ == WORK_STEALING) {
+        while(true) {
+            if(GetLocal(index, task) || Steal(index, task))
+                return true;
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++idle_;
+            condition_.wait(lock, [this]{
+                return terminate_ || pending_ > 0;
+            });
+            --idle_;
+
+            if(terminate_)
+                return false;
+        }
+    }
 
     std::unique_lock<std::mutex> lock(mutex_);
 
-    if(tasks_.empty()) {
-        condition_.wait(lock, [this]{
-            return terminate_ || !tasks_.empty();
+    while(pending_ == 0 && !terminate_) {
+        ++idle_;
+        if(!elastic_) {
+            condition_.wait(lock, [this]{
+                return terminate_ || pending_ > 0;
+            });
+            --idle_;
+            continue;
+        }
+
+        bool woken = condition_.wait_for(lock, std::chrono::milliseconds(linger_ms_), [this]{
+            return terminate_ || pending_ > 0;
         });
+        --idle_;
+
+        // 空闲超过 linger 时间且线程数多于下限, 退出本线程
+        if(!woken && live_threads_ > min_threads_) {
+            --live_threads_;
+            retired_.push_back(index);
+            retire = true;
+            return false;
+        }
     }
 
     if(terminate_)
         return false;
 
-    if(!tasks_.empty()) {
-        task = std::move(tasks_.front());
-        tasks_.pop();
+    if(PopShared(task)) {
+        ++atomic_;
+        --pending_;
+        if(blocked_ > 0)
+            not_full_.notify_one();
+
+        if(elastic_) {
+            // 排队时间的指数滑动平均, 权重 1/8
+            int64_t now = getSteadyUs();
+            int64_t wait = now - task._enqueueTime;
+            wait_ewma_us_ += (wait - wait_ewma_us_) / 8;
+            last_dequeue_us_ = now;
+            MaybeGrow(now);
+        }
         return true;
     }
 
@@ -146,4 +970,12 @@ int64_t getNowMs() {
     getNow(&tv);
 
     return tv.tv_sec * (int64_t)1000 + tv.tv_usec / 1000;
-}
\ No newline at end of file
+}
+
+int64_t getSteadyUs() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * (int64_t)1000000 + ts.tv_nsec / 1000;
+}
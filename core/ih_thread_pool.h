@@ -1,83 +1,445 @@
 #ifndef _IH_THREAD_POOL_H_
 #define _IH_THREAD_POOL_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
 #include <sys/time.h>
 
+#include "ih_futex.h"
+#include "ih_histogram.h"
+#include "ih_mpmc_ring.h"
+#include "ih_task.h"
+
 void getNow(timeval* tv);
 int64_t getNowMs();
+// 单调时钟, 微秒. 用于测量排队和执行耗时, 不受系统时间调整影响
+int64_t getSteadyUs();
 
 #define TNOW getNow()
 #define TNOWMS getNowMs()
 
 class ThreadPool {
 
+public:
+    // 内联存放任务的字节数, 超过的可调用对象会退化为一次堆分配
+    static const size_t kTaskInlineSize = 64;
+    // 无锁模式下未设置容量时环形队列的大小
+    static const size_t kRingSize = 4096;
+
 protected:
     struct TaskFunc {
-        TaskFunc(uint64_t expireTime) : _expireTime(expireTime) {}
+        TaskFunc() {}
+        TaskFunc(int64_t expireTime, uint32_t lane = 0, uint32_t label = 0)
+            : _expireTime(expireTime), _lane(lane), _label(label) {}
 
-        std::function<void()> _func;
+        InlineTask<kTaskInlineSize> _func;
         int64_t _expireTime = 0;
+        int64_t _enqueueTime = 0;   // 入队时刻, getSteadyUs()
+        uint64_t _seq = 0;          // 共享队列里带超时任务的入队序号, 截止时间相同时先提交的先出
+        uint32_t _lane = 0;
+        uint32_t _label = 0;        // 统计标签, 0 表示未标记
+    };
+
+    // 共享队列: 没有超时时间的任务先进先出, 有超时时间的任务按截止时间排成小顶堆(EDF).
+    // 无超时任务以 入队时刻 + kFifoSlackMs 作为截止时间和堆顶比较, 持续到来的超时任务
+    // 不会把它们饿死. 已超时的任务总在堆顶, 空闲线程会最先把它们清理掉
+    struct TaskQueue {
+        static const int64_t kFifoSlackMs = 50;
+
+        void Push(TaskFunc&& task);
+        void Pop(TaskFunc& task);
+        void PopOldest(TaskFunc& task);
+        bool Empty() const { return fifo_.Empty() && timed_.empty(); }
+        size_t Size() const { return fifo_.Size() + timed_.size(); }
+        static bool Later(const TaskFunc& a, const TaskFunc& b);
+
+        TaskRing<TaskFunc> fifo_;
+        std::vector<TaskFunc> timed_;
+        uint64_t seq_ = 0;
+    };
+
+    // 每个统计标签一组直方图: 入队到开始执行的等待时间, 执行时间
+    struct LabelHistograms {
+        LatencyHistogram wait_;
+        LatencyHistogram run_;
+    };
+
+    // 每个工作线程独占一份统计, 只有本线程写, 快照时其他线程只读.
+    // 各标签的直方图在第一次用到时才分配
+    struct alignas(64) WorkerStats {
+        static const uint32_t kMaxLabels = 32;
+
+        WorkerStats();
+        ~WorkerStats();
+        LabelHistograms* Get(uint32_t label);
+
+        std::atomic<uint64_t> executed_{0};
+        std::atomic<uint64_t> expired_{0};
+        std::atomic<LabelHistograms*> labels_[kMaxLabels];
+    };
+
+    // 工作窃取模式下每个线程私有的任务队列, 本线程从尾部取, 其他线程从头部偷.
+    // 这里不按截止时间排序, 超时任务在出队时才被发现
+    struct Worker {
+        std::mutex mutex_;
+        TaskRing<TaskFunc> tasks_;
     };
-    typedef std::shared_ptr<struct TaskFunc> TaskFuncPtr;
 
 public:
 
+    enum ScheduleMode {
+        SHARED_QUEUE = 0,   // 所有线程共用一个队列(默认)
+        WORK_STEALING = 1,  // 每个线程一个双端队列, 空闲时从其他线程偷任务
+        LOCK_FREE = 2,      // 所有线程共用一个有界无锁环形队列, 空闲线程睡在 futex 上.
+                            // 不区分通道, 超时任务在出队时才被发现, 容量即环形队列大小
+    };
+
+    // 共享队列模式下的优先级通道, 数值越小优先级越高. 默认三个通道, 权重 8:4:1,
+    // 可以用 SetLanes 重新配置; 工作窃取模式忽略通道
+    enum Lane {
+        LANE_HIGH = 0,        // 列表/计数/浏览等对延迟敏感的请求
+        LANE_NORMAL = 1,      // 默认
+        LANE_BACKGROUND = 2,  // 缩略图, md5, pv 计数落盘等后台任务
+    };
+
+    // 队列满时的处理策略
+    enum OverflowPolicy {
+        OVERFLOW_BLOCK = 0,        // 阻塞提交线程直到有空位
+        OVERFLOW_REJECT = 1,       // 拒绝新任务, future 以 resource_unavailable_try_again 完成
+        OVERFLOW_DROP_OLDEST = 2,  // 丢弃最老的任务, 其 future 以 operation_canceled 完成
+        OVERFLOW_CALLER_RUNS = 3,  // 在提交线程上直接执行
+    };
+
     ThreadPool();
     virtual ~ThreadPool();
-    bool Init(size_t num);
-    size_t GetThreadNum();
+    bool Init(size_t num, ScheduleMode mode = SHARED_QUEUE);
+    size_t GetThreadNum();   // 当前存活的工作线程数
     size_t GetJobNum();
+    ScheduleMode GetMode() { return mode_; }
+
+    // 限制排队任务数, 0 表示不限制(默认). 可以在运行中调整.
+    // 无锁模式下容量决定环形队列大小(0 为 kRingSize), 只能在 Start 之前修改,
+    // 运行中只能改策略; 队列满时即使容量为 0 也按策略处理
+    bool SetCapacity(size_t capacity, OverflowPolicy policy = OVERFLOW_BLOCK);
+    size_t GetCapacity() { return capacity_; }
+    // 排队任务数的历史最大值, HTTP 层可据此提前降级
+    size_t GetHighWaterMark() { return high_water_; }
+    void ResetHighWaterMark() { high_water_ = pending_.load(); }
+    // 等工作线程退出, 还在排队的任务以 operation_canceled 丢弃(不计入 GetDroppedNum);
+    // Stop 之后、再次 Start 之前提交的任务同样直接丢弃
     void Stop();
     bool Start();
+    // 是否已经 Stop(还没有再次 Start)
+    bool IsTerminate() {return terminate_;}
+
+    // 弹性模式(仅共享队列模式, Start 之前调用): 线程数在 [minThreads, maxThreads]
+    // 之间变化. 排队时间的滑动平均持续高于 targetWaitMs 时增加线程,
+    // 线程空闲超过 lingerMs 后退出, 两个时间都必须大于 0.
+    // 适合大量任务阻塞在数据库 I/O 上的场景
+    bool SetElastic(size_t minThreads, size_t maxThreads,
+                    int64_t targetWaitMs, int64_t lingerMs);
+    // 出队任务排队时间的滑动平均(微秒), 仅弹性模式下统计
+    int64_t GetQueueWaitUs() { return wait_ewma_us_; }
+
+    // 线程绑核(Start 之前调用, 仅 Linux 生效). pinEach 为 true 时第 i 个线程
+    // 绑到 cpus[i % cpus.size()], 否则所有线程共用 cpus 这一个 cpuset
+    bool SetAffinity(const std::vector<int>& cpus, bool pinEach = true);
+
+    // 按权重配置通道, 每一轮里每个通道最多出队 weight 个任务, 出队时总是先看
+    // 高优先级通道, 低优先级通道也保证每轮有配额不会饿死. 只能在队列为空时调用, 越界的通道号归入最后一个通道
+    bool SetLanes(const std::vector<uint32_t>& weights);
+    size_t GetLaneNum() { return lanes_.size(); }
+
+    // 提交任务时可选的标记: 所在通道和统计标签(RegisterLabel 的返回值)
+    struct TaskTag {
+        TaskTag(Lane lane = LANE_NORMAL, uint32_t label = 0) : _lane(lane), _label(label) {}
+
+        Lane _lane;
+        uint32_t _label;
+    };
 
     template <class F, class... Args>
     auto Exec(F &&f, Args &&... args) -> std::future<decltype(f(args...))> {
-        return Exec(0, f, args...);
+        return Exec(TaskTag(), 0, std::forward<F>(f), std::forward<Args>(args)...);
     }
 
     template <class F, class... Args>
     auto Exec(int64_t timeoutMs, F &&f, Args &&...args)
         -> std::future<decltype(f(args...))> {
+        return Exec(TaskTag(), timeoutMs, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Exec(Lane lane, F &&f, Args &&... args) -> std::future<decltype(f(args...))> {
+        return Exec(TaskTag(lane), 0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Exec(Lane lane, int64_t timeoutMs, F &&f, Args &&...args)
+        -> std::future<decltype(f(args...))> {
+        return Exec(TaskTag(lane), timeoutMs, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Exec(const TaskTag& tag, F &&f, Args &&... args) -> std::future<decltype(f(args...))> {
+        return Exec(tag, 0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Exec(const TaskTag& tag, int64_t timeoutMs, F &&f, Args &&...args)
+        -> std::future<decltype(f(args...))> {
 
         int64_t expireTime = (timeoutMs == 0 ? 0 : TNOWMS + timeoutMs);
 
         using RetType = decltype(f(args...));
-        auto task = std::make_shared<std::packaged_task<RetType>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        PromiseTask<RetType, decltype(bound)> task(std::move(bound));
+        std::future<RetType> future = task._promise.get_future();
 
-        TaskFuncPtr fPtr = std::make_shared<TaskFunc>(expireTime);
-        fPtr->_func = [task](){(*task)();}
-        tasks_.push(fPtr);
-        condition_.notify_one();
-        return task->get_future();
+        // promise 和绑定的参数内联存放, 只有 future 的共享状态需要分配
+        TaskFunc taskFunc(expireTime, tag._lane, tag._label);
+        taskFunc._func.Assign(std::move(task));
+        Push(std::move(taskFunc));
+        return future;
+    }
+
+    // 带丢弃回调: 任务超时没有执行时, future 以 std::errc::timed_out 的
+    // std::system_error 完成, 然后调用 onExpire(例如回 503).
+    // 任务因队列满被拒绝或丢弃时同样会调用 onExpire
+    template <class E, class F, class... Args>
+    auto ExecTimeout(int64_t timeoutMs, E &&onExpire, F &&f, Args &&...args)
+        -> std::future<decltype(f(args...))> {
+        return ExecTimeout(TaskTag(), timeoutMs, std::forward<E>(onExpire),
+            std::forward<F>(f), std::forward<Args>(args)...);
     }
 
+    template <class E, class F, class... Args>
+    auto ExecTimeout(Lane lane, int64_t timeoutMs, E &&onExpire, F &&f, Args &&...args)
+        -> std::future<decltype(f(args...))> {
+        return ExecTimeout(TaskTag(lane), timeoutMs, std::forward<E>(onExpire),
+            std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class E, class F, class... Args>
+    auto ExecTimeout(const TaskTag& tag, int64_t timeoutMs, E &&onExpire, F &&f, Args &&...args)
+        -> std::future<decltype(f(args...))> {
+
+        int64_t expireTime = (timeoutMs == 0 ? 0 : TNOWMS + timeoutMs);
+
+        using RetType = decltype(f(args...));
+        auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        typedef PromiseTask<RetType, decltype(bound)> Task;
+        typedef typename std::decay<E>::type OnExpire;
+        ExpirableTask<Task, OnExpire> task(Task(std::move(bound)), OnExpire(std::forward<E>(onExpire)));
+        std::future<RetType> future = task._task._promise.get_future();
+
+        TaskFunc taskFunc(expireTime, tag._lane, tag._label);
+        taskFunc._func.Assign(std::move(task));
+        Push(std::move(taskFunc));
+        return future;
+    }
+
+    // 不需要结果的任务: 可调用对象和参数直接存放在队列槽位里,
+    // 只要能内联存放, 稳定状态下不做任何堆分配. 不带参数时可调用对象原样存放,
+    // 它如果有 Cancel(std::errc) 成员, 任务超时, 被拒绝或被丢弃时会调用
+    template <class F, class... Args>
+    auto Post(F &&f, Args &&... args) -> decltype(void(f(args...))) {
+        Post(TaskTag(), 0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Post(int64_t timeoutMs, F &&f, Args &&...args)
+        -> decltype(void(f(args...))) {
+        Post(TaskTag(), timeoutMs, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Post(Lane lane, F &&f, Args &&... args) -> decltype(void(f(args...))) {
+        Post(TaskTag(lane), 0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Post(Lane lane, int64_t timeoutMs, F &&f, Args &&...args)
+        -> decltype(void(f(args...))) {
+        Post(TaskTag(lane), timeoutMs, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Post(const TaskTag& tag, F &&f, Args &&... args) -> decltype(void(f(args...))) {
+        Post(tag, 0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class F, class... Args>
+    auto Post(const TaskTag& tag, int64_t timeoutMs, F &&f, Args &&...args)
+        -> decltype(void(f(args...))) {
+
+        int64_t expireTime = (timeoutMs == 0 ? 0 : TNOWMS + timeoutMs);
+
+        TaskFunc taskFunc(expireTime, tag._lane, tag._label);
+        if constexpr(sizeof...(Args) == 0)
+            taskFunc._func.Assign(std::forward<F>(f));
+        else
+            taskFunc._func.Assign(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        Push(std::move(taskFunc));
+    }
+
+    template <class E, class F, class... Args>
+    auto PostTimeout(int64_t timeoutMs, E &&onExpire, F &&f, Args &&...args)
+        -> decltype(void(f(args...))) {
+        PostTimeout(TaskTag(), timeoutMs, std::forward<E>(onExpire),
+            std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class E, class F, class... Args>
+    auto PostTimeout(Lane lane, int64_t timeoutMs, E &&onExpire, F &&f, Args &&...args)
+        -> decltype(void(f(args...))) {
+        PostTimeout(TaskTag(lane), timeoutMs, std::forward<E>(onExpire),
+            std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template <class E, class F, class... Args>
+    auto PostTimeout(const TaskTag& tag, int64_t timeoutMs, E &&onExpire, F &&f, Args &&...args)
+        -> decltype(void(f(args...))) {
+
+        int64_t expireTime = (timeoutMs == 0 ? 0 : TNOWMS + timeoutMs);
+
+        auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        typedef typename std::decay<E>::type OnExpire;
+        TaskFunc taskFunc(expireTime, tag._lane, tag._label);
+        taskFunc._func.Assign(ExpirableTask<decltype(bound), OnExpire>(
+            std::move(bound), OnExpire(std::forward<E>(onExpire))));
+        Push(std::move(taskFunc));
+    }
+
+    // 注册统计标签(比如每种 HTTP 处理函数一个), 返回值放进 TaskTag 提交任务.
+    // 标签号 0 留给未标记的任务, 标签用完时返回 0
+    uint32_t RegisterLabel(const std::string& name);
+    // 统计默认打开, 每个任务多两次读时钟
+    void EnableStats(bool enable) { stats_enabled_ = enable; }
+
+    struct LabelStats {
+        std::string _name;
+        HistogramSnapshot _wait;   // 入队到开始执行, 微秒
+        HistogramSnapshot _run;    // 执行时间, 微秒
+    };
+
+    struct Stats {
+        uint64_t _executed = 0;
+        uint64_t _expired = 0;
+        std::vector<LabelStats> _labels;   // 下标即标签号
+    };
+
+    // 汇总所有线程的计数和直方图. 工作线程记录时不加锁, 这里也不会打断它们
+    Stats GetStats();
+
+    // 因超时而未执行的任务数
+    size_t GetExpiredNum() { return expired_num_; }
+    // 因队列满被拒绝 / 被挤掉的任务数
+    size_t GetRejectedNum() { return rejected_num_; }
+    size_t GetDroppedNum() { return dropped_num_; }
+
     bool WaitForAllDone(int millsecond = -1);
 protected:
 
-    bool Get(TaskFuncPtr& task);
+    void Push(TaskFunc&& task);
+    void PushStealing(TaskFunc&& task);
+    void PushLockFree(TaskFunc&& task);
+    void NotifyIdle();
+    void NotifyNotFull();
+    void UpdateHighWater(size_t depth);
+    void Reject(TaskFunc& task);
+    void Drop(TaskFunc& task);
 
-    bool IsTerminate() {return terminate_;}
+    bool Get(size_t index, TaskFunc& task, bool& retire);
+    bool PopShared(TaskFunc& task);
+    bool PopOldestShared(TaskFunc& task);
+    bool GetLocal(size_t index, TaskFunc& task);
+    bool Steal(size_t index, TaskFunc& task);
+    bool GetLockFree(TaskFunc& task);
+    void WakeLockFree();
+
+    bool IsAllDone() {return pending_ == 0 && atomic_ == 0;}
+
+    void Run(size_t index);
+    void SpawnThread();
+    void ApplyAffinity(size_t index);
+    void MaybeGrow(int64_t now);
 
-    void Run();
+    // 执行任务, 已超时的任务只做超时处理, 返回任务是否真正执行了
+    bool Execute(TaskFunc& task);
+    // 在当前线程执行并记录统计, stats 为 NULL 时不记录
+    void ExecuteAndRecord(TaskFunc& task, WorkerStats* stats, bool shared);
+    void Expire(TaskFunc& task);
+
+    // 当前线程在本线程池中的下标, 不是本池的工作线程时返回 -1
+    int CurrentWorker();
 
 protected:
-    
-    std::queue<struct TaskFunc> tasks_;
+
+    // 共享队列模式下每个通道一个队列, lane_credit_ 为本轮剩余配额
+    std::vector<std::unique_ptr<TaskQueue>> lanes_;
+    std::vector<uint32_t> lane_weight_;
+    std::vector<uint32_t> lane_credit_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    // 无锁模式: 空闲线程睡在 task_seq_ 上, 队列满时阻塞的提交线程睡在 space_seq_ 上,
+    // 唤醒方先加序号再 FutexWake, 睡眠前读到的序号变了就不会睡下去
+    std::unique_ptr<MpmcRing<TaskFunc> > ring_;
+    std::atomic<uint32_t> task_seq_{0};
+    std::atomic<uint32_t> space_seq_{0};
+    std::atomic<bool> waking_{false};   // 有线程已被唤醒, 还没取到任务
 
     std::vector<std::thread*> threads_;
     std::mutex mutex_;
     std::condition_variable condition_;
+    std::condition_variable done_condition_;
+    std::condition_variable not_full_;
     size_t thread_num_;
-    bool terminate_;
-    std::atomic<int> atomic_{0}; 
+    ScheduleMode mode_;
+    std::atomic<bool> terminate_;
+    std::atomic<int> atomic_{0};         // 正在执行的任务数
+    std::atomic<size_t> pending_{0};     // 已入队还未被取走的任务数
+    std::atomic<size_t> idle_{0};        // 挂起等待任务的线程数
+    std::atomic<size_t> next_worker_{0}; // 外部线程提交时轮询投递的下标
+    std::atomic<size_t> expired_num_{0};
+    std::atomic<size_t> rejected_num_{0};
+    std::atomic<size_t> dropped_num_{0};
+    std::atomic<size_t> capacity_{0};
+    std::atomic<OverflowPolicy> policy_;
+    std::atomic<size_t> blocked_{0};     // 因队列满而阻塞的提交线程数
+    std::atomic<size_t> high_water_{0};
+
+    // 弹性模式, 以下除原子变量外都由 mutex_ 保护
+    bool elastic_ = false;
+    size_t min_threads_ = 0;
+    size_t max_threads_ = 0;
+    int64_t target_wait_us_ = 0;
+    int64_t linger_ms_ = 0;
+    int64_t last_grow_us_ = 0;
+    int64_t last_dequeue_us_ = 0;
+    std::atomic<int64_t> wait_ewma_us_{0};
+    std::atomic<size_t> live_threads_{0};
+    std::vector<size_t> retired_;         // 已退出待 join 的线程下标
+
+    std::vector<int> cpus_;
+    bool pin_each_ = true;
+
+    // 统计: stats_ 下标同线程下标, 在 Start 时按最大线程数分配;
+    // external_stats_ 记录在提交线程上执行的任务(OVERFLOW_CALLER_RUNS)
+    std::atomic<bool> stats_enabled_{true};
+    std::vector<std::unique_ptr<WorkerStats> > stats_;
+    std::unique_ptr<WorkerStats> external_stats_;
+    std::vector<std::string> label_names_;
 };
 
-#endif
\ No newline at end of file
+#endif
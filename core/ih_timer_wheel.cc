@@ -0,0 +1,351 @@
+#include "ih_timer_wheel.h"
+
+TimerWheel::TimerWheel()
+    : pool_(NULL), lane_(ThreadPool::LANE_NORMAL), tick_us_(10000), start_us_(0), now_tick_(0),
+      timer_num_(0), dropped_num_(0), free_(kNil), thread_(NULL), terminate_(false) {
+
+    for(uint32_t i = 0; i < kSlotNum; i++)
+        slots_[i] = kNil;
+}
+
+TimerWheel::~TimerWheel() {
+
+    Stop();
+}
+
+bool TimerWheel::Init(ThreadPool* pool, int64_t tickMs, ThreadPool::Lane lane) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(thread_ != NULL || timer_num_ != 0 || pool == NULL || tickMs <= 0)
+        return false;
+
+    pool_ = pool;
+    lane_ = lane;
+    tick_us_ = tickMs * 1000;
+    start_us_ = getSteadyUs();
+    now_tick_ = 0;
+    return true;
+}
+
+bool TimerWheel::Start() {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(thread_ != NULL || pool_ == NULL)
+        return false;
+
+    terminate_ = false;
+    thread_ = new std::thread(&TimerWheel::Run, this);
+    return true;
+}
+
+void TimerWheel::Stop() {
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        terminate_ = true;
+        condition_.notify_all();
+    }
+
+    if(thread_ != NULL) {
+        if(thread_->joinable())
+            thread_->join();
+        delete thread_;
+        thread_ = NULL;
+    }
+}
+
+size_t TimerWheel::GetTimerNum() {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    return timer_num_;
+}
+
+uint64_t TimerWheel::GetDroppedNum() {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    return dropped_num_;
+}
+
+int64_t TimerWheel::NowTick() {
+
+    return (getSteadyUs() - start_us_) / tick_us_;
+}
+
+TimerWheel::TimerId TimerWheel::Add(TimerFunc&& func, int64_t delayMs, int64_t intervalMs) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(pool_ == NULL)
+        return 0;
+
+    if(delayMs < 0)
+        delayMs = 0;
+
+    uint32_t index = Alloc();
+    TimerNode& node = Node(index);
+    node._func = std::move(func);
+    node._interval = intervalMs <= 0 ? 0 : (intervalMs * 1000 + tick_us_ - 1) / tick_us_;
+    node._cancelled = false;
+    node._retries = 0;
+    node._state = TIMER_PENDING;
+
+    // 到期 tick 向上取整, 保证不会提前触发
+    int64_t elapsed = getSteadyUs() - start_us_;
+    node._expire = (elapsed + delayMs * 1000 + tick_us_ - 1) / tick_us_;
+    if(node._expire < now_tick_)
+        node._expire = now_tick_;
+
+    Link(index);
+    return ((TimerId)node._generation << 32) | index;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint32_t index;
+    TimerNode* node = Find(id, index);
+    if(node == NULL || node->_cancelled)
+        return false;
+
+    switch(node->_state) {
+    case TIMER_PENDING:
+        Unlink(index);
+        Free(index);
+        return true;
+    case TIMER_QUEUED:
+        // 任务已经在线程池里, 执行时发现被取消再释放
+        node->_cancelled = true;
+        return true;
+    case TIMER_RUNNING:
+        if(node->_interval == 0)
+            return false;
+        node->_cancelled = true;
+        return true;
+    }
+
+    return false;
+}
+
+uint32_t TimerWheel::Alloc() {
+
+    if(free_ == kNil) {
+        uint32_t base = (uint32_t)chunks_.size() << kChunkBits;
+        uint32_t num = 1 << kChunkBits;
+        chunks_.push_back(std::unique_ptr<TimerNode[]>(new TimerNode[num]));
+        for(uint32_t i = num; i > 0; i--) {
+            TimerNode& node = Node(base + i - 1);
+            node._generation = 1;
+            node._next = free_;
+            free_ = base + i - 1;
+        }
+    }
+
+    uint32_t index = free_;
+    free_ = Node(index)._next;
+    Node(index)._next = kNil;
+    ++timer_num_;
+    return index;
+}
+
+void TimerWheel::Free(uint32_t index) {
+
+    TimerNode& node = Node(index);
+    node._func.Reset();
+    node._state = TIMER_FREE;
+    node._retries = 0;
+    node._cancelled = false;
+    node._prev = kNil;
+    node._slot = kNil;
+    // 代数变化后旧的 TimerId 失效, 跳过 0 保证 id 不为 0
+    if(++node._generation == 0)
+        node._generation = 1;
+
+    node._next = free_;
+    free_ = index;
+    --timer_num_;
+}
+
+TimerWheel::TimerNode* TimerWheel::Find(TimerId id, uint32_t& index) {
+
+    index = (uint32_t)(id & 0xffffffff);
+    uint32_t generation = (uint32_t)(id >> 32);
+    if(index >= ((uint32_t)chunks_.size() << kChunkBits))
+        return NULL;
+
+    TimerNode& node = Node(index);
+    if(node._state == TIMER_FREE || node._generation != generation)
+        return NULL;
+
+    return &node;
+}
+
+void TimerWheel::Link(uint32_t index) {
+
+    TimerNode& node = Node(index);
+    int64_t delta = node._expire - now_tick_;
+
+    uint32_t slot;
+    if(delta < (int64_t)kRootSize) {
+        // 已经过期的放进当前 tick 的槽, 马上处理
+        int64_t expire = delta < 0 ? now_tick_ : node._expire;
+        slot = (uint32_t)(expire & (kRootSize - 1));
+    }
+    else {
+        // 超出最高层范围的先放在最高层最远的槽, 转到下层时再按真实到期时间放置
+        int64_t expire = node._expire;
+        if(delta >= ((int64_t)1 << kMaxBits))
+            expire = now_tick_ + ((int64_t)1 << kMaxBits) - 1;
+
+        int level = 1;
+        while(level < kLevels - 1 &&
+              expire - now_tick_ >= ((int64_t)1 << (kRootBits + level * kLevelBits)))
+            level++;
+
+        int shift = kRootBits + (level - 1) * kLevelBits;
+        slot = kRootSize + (level - 1) * kLevelSize +
+               (uint32_t)((expire >> shift) & (kLevelSize - 1));
+    }
+
+    node._slot = slot;
+    node._prev = kNil;
+    node._next = slots_[slot];
+    if(slots_[slot] != kNil)
+        Node(slots_[slot])._prev = index;
+    slots_[slot] = index;
+}
+
+void TimerWheel::Unlink(uint32_t index) {
+
+    TimerNode& node = Node(index);
+    if(node._prev != kNil)
+        Node(node._prev)._next = node._next;
+    else
+        slots_[node._slot] = node._next;
+
+    if(node._next != kNil)
+        Node(node._next)._prev = node._prev;
+
+    node._prev = kNil;
+    node._next = kNil;
+    node._slot = kNil;
+}
+
+void TimerWheel::Cascade(uint32_t slot) {
+
+    // 把高层一个槽里的定时器按剩余时间重新放到下层
+    uint32_t index = slots_[slot];
+    slots_[slot] = kNil;
+    while(index != kNil) {
+        uint32_t next = Node(index)._next;
+        Link(index);
+        index = next;
+    }
+}
+
+void TimerWheel::Tick() {
+
+    uint32_t root = (uint32_t)(now_tick_ & (kRootSize - 1));
+    if(root == 0) {
+        // 第 0 层转完一圈, 从上一层取下一个槽; 上一层也转完一圈时继续往上
+        for(int level = 1; level < kLevels; level++) {
+            int shift = kRootBits + (level - 1) * kLevelBits;
+            uint32_t i = (uint32_t)((now_tick_ >> shift) & (kLevelSize - 1));
+            Cascade(kRootSize + (level - 1) * kLevelSize + i);
+            if(i != 0)
+                break;
+        }
+    }
+
+    uint32_t index = slots_[root];
+    slots_[root] = kNil;
+    while(index != kNil) {
+        TimerNode& node = Node(index);
+        uint32_t next = node._next;
+        node._prev = kNil;
+        node._next = kNil;
+        node._slot = kNil;
+        node._state = TIMER_QUEUED;
+        firing_.push_back(((TimerId)node._generation << 32) | index);
+        index = next;
+    }
+
+    ++now_tick_;
+}
+
+void TimerWheel::Run() {
+
+    std::vector<TimerId> firing;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!terminate_) {
+        int64_t target = NowTick();
+        while(now_tick_ <= target)
+            Tick();
+
+        if(!firing_.empty()) {
+            // 投递时不持有时间轮的锁: 线程池满时可能在本线程直接执行回调
+            firing.swap(firing_);
+            lock.unlock();
+            for(size_t i = 0; i < firing.size(); i++)
+                pool_->Post(lane_, FireTask(this, firing[i]));
+            firing.clear();
+            lock.lock();
+            continue;
+        }
+
+        // 睡到下一个 tick 开始
+        int64_t wait = start_us_ + now_tick_ * tick_us_ - getSteadyUs();
+        if(wait > 0)
+            condition_.wait_for(lock, std::chrono::microseconds(wait));
+    }
+}
+
+void TimerWheel::Fire(TimerId id, bool run, std::errc code) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint32_t index;
+    TimerNode* node = Find(id, index);
+    if(node == NULL || node->_state != TIMER_QUEUED)
+        return;
+
+    // 节点所在的块不会释放, 解锁执行期间 node 一直有效; 其他线程只会设置 _cancelled
+    if(run && !node->_cancelled) {
+        node->_state = TIMER_RUNNING;
+        lock.unlock();
+        try {
+            node->_func();
+        }
+        catch(...) {
+        }
+        lock.lock();
+    }
+
+    // 线程池已经停止, 重试只会被一直丢弃, 直接释放
+    bool stopped = !run && code == std::errc::operation_canceled && pool_->IsTerminate();
+    if(node->_cancelled || stopped || (run && node->_interval == 0)) {
+        Free(index);
+        return;
+    }
+
+    if(!run)
+        ++dropped_num_;
+
+    int64_t next;
+    if(node->_interval == 0) {
+        // 一次性定时器被线程池拒绝或丢弃, 退避后重试, 直到执行或被取消, 不会悄悄丢失
+        next = now_tick_ + ((int64_t)1 << node->_retries) - 1;
+        if(node->_retries < kMaxRetryShift)
+            ++node->_retries;
+    }
+    else {
+        // 按原来的节奏安排下一次, 跳过已经错过的周期
+        int64_t now = NowTick();
+        next = node->_expire + node->_interval;
+        if(next <= now)
+            next = node->_expire + node->_interval * ((now - node->_expire) / node->_interval + 1);
+        if(next < now_tick_)
+            next = now_tick_;
+    }
+
+    node->_expire = next;
+    node->_state = TIMER_PENDING;
+    Link(index);
+}
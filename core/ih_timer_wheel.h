@@ -0,0 +1,154 @@
+#ifndef _IH_TIMER_WHEEL_H_
+#define _IH_TIMER_WHEEL_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "ih_task.h"
+#include "ih_thread_pool.h"
+
+// 分层时间轮(同 Linux 内核经典实现): 第 0 层 256 个槽, 每槽一个 tick; 往上三层各 64 个槽,
+// 每层一个槽覆盖下一层一整圈. tick 默认 10ms, 最远约 7.7 天, 更远的定时器到期前会被重新放置.
+// 加入和取消都是 O(1), 节点按块分配并复用, 可以容纳上百万个定时器(比如每个连接一个空闲超时).
+//
+// 到期的回调投递到 ThreadPool 上执行, 周期定时器在本次回调执行完后才安排下一次, 不会重叠执行.
+// 时间轮要在线程池停止之后再析构, 否则已投递的回调可能访问已经销毁的时间轮.
+//
+//     TimerWheel wheel;
+//     wheel.Init(&pool);
+//     wheel.Start();
+//     TimerWheel::TimerId id = wheel.ScheduleEvery(60000, []{ FlushPvCount(); });
+//     wheel.Cancel(id);
+class TimerWheel {
+
+public:
+    typedef uint64_t TimerId;   // 0 表示无效
+
+    // 回调内联存放的字节数, 通常只捕获一两个指针, 取小一些节省百万级节点的内存
+    static const size_t kTimerInlineSize = 32;
+
+    TimerWheel();
+    ~TimerWheel();
+
+    // 回调在 pool 的 lane 通道上执行
+    bool Init(ThreadPool* pool, int64_t tickMs = 10,
+              ThreadPool::Lane lane = ThreadPool::LANE_NORMAL);
+    bool Start();
+    // 停止走时, 未到期的定时器保留, 再次 Start 后继续计时
+    void Stop();
+
+    // delayMs 之后执行一次
+    template <class F>
+    TimerId ScheduleAfter(int64_t delayMs, F&& f) {
+        TimerFunc func;
+        func.Assign(std::forward<F>(f));
+        return Add(std::move(func), delayMs, 0);
+    }
+
+    // 每 intervalMs 执行一次, 第一次在 firstDelayMs 之后(小于 0 时等于 intervalMs).
+    // 回调执行得比周期还慢时跳过错过的周期, 不补跑
+    template <class F>
+    TimerId ScheduleEvery(int64_t intervalMs, F&& f, int64_t firstDelayMs = -1) {
+        if(intervalMs <= 0)
+            return 0;
+        TimerFunc func;
+        func.Assign(std::forward<F>(f));
+        return Add(std::move(func), firstDelayMs < 0 ? intervalMs : firstDelayMs, intervalMs);
+    }
+
+    // 取消成功返回 true. 一次性定时器的回调已经开始执行时返回 false;
+    // 周期定时器正在执行时返回 true, 本次执行完后不再安排
+    bool Cancel(TimerId id);
+
+    // 还没有结束的定时器数
+    size_t GetTimerNum();
+    // 到期回调被线程池拒绝或丢弃的次数. 一次性定时器被丢弃后退避重试(1, 2, 4 ... 最多
+    // 256 个 tick), 周期定时器等下一个周期. 线程池已经 Stop 时到期的定时器直接释放, 不计入
+    uint64_t GetDroppedNum();
+
+protected:
+    typedef InlineTask<kTimerInlineSize> TimerFunc;
+
+    static const int kRootBits = 8;
+    static const int kLevelBits = 6;
+    static const int kLevels = 4;
+    static const uint32_t kRootSize = 1 << kRootBits;
+    static const uint32_t kLevelSize = 1 << kLevelBits;
+    static const uint32_t kSlotNum = kRootSize + (kLevels - 1) * kLevelSize;
+    static const int kMaxBits = kRootBits + (kLevels - 1) * kLevelBits;
+    static const uint32_t kChunkBits = 10;
+    static const uint32_t kNil = 0xffffffff;
+    static const int kMaxRetryShift = 8;
+
+    enum TimerState {
+        TIMER_FREE = 0,
+        TIMER_PENDING = 1,   // 挂在时间轮上
+        TIMER_QUEUED = 2,    // 已到期, 投递到线程池还没开始执行
+        TIMER_RUNNING = 3,
+    };
+
+    struct TimerNode {
+        TimerFunc _func;
+        int64_t _expire = 0;     // 到期 tick
+        int64_t _interval = 0;   // 周期(tick), 0 表示一次性
+        uint32_t _prev = kNil;
+        uint32_t _next = kNil;   // 空闲时串成空闲链表
+        uint32_t _slot = kNil;
+        uint32_t _generation = 0;
+        uint8_t _state = TIMER_FREE;
+        uint8_t _retries = 0;    // 一次性定时器连续被丢弃的次数, 决定重试的退避
+        bool _cancelled = false;
+    };
+
+    // 投递到线程池的到期任务, 被丢弃时线程池通过 Cancel 告知原因
+    struct FireTask {
+        FireTask(TimerWheel* wheel, TimerId id) : _wheel(wheel), _id(id) {}
+        void operator()() { _wheel->Fire(_id, true, std::errc()); }
+        void Cancel(std::errc code) { _wheel->Fire(_id, false, code); }
+
+        TimerWheel* _wheel;
+        TimerId _id;
+    };
+
+    TimerId Add(TimerFunc&& func, int64_t delayMs, int64_t intervalMs);
+    uint32_t Alloc();
+    void Free(uint32_t index);
+    TimerNode& Node(uint32_t index) {
+        return chunks_[index >> kChunkBits][index & ((1 << kChunkBits) - 1)];
+    }
+    TimerNode* Find(TimerId id, uint32_t& index);
+
+    void Link(uint32_t index);
+    void Unlink(uint32_t index);
+    void Cascade(uint32_t slot);
+    void Tick();
+    void Run();
+    // 线程池上执行到期的定时器, run 为 false 表示任务被线程池丢弃, code 为丢弃原因
+    void Fire(TimerId id, bool run, std::errc code);
+    int64_t NowTick();
+
+protected:
+    ThreadPool* pool_;
+    ThreadPool::Lane lane_;
+    int64_t tick_us_;
+    int64_t start_us_;
+    int64_t now_tick_;          // 下一个要处理的 tick
+    size_t timer_num_;
+    uint64_t dropped_num_;
+
+    std::vector<std::unique_ptr<TimerNode[]> > chunks_;
+    uint32_t free_;
+    uint32_t slots_[kSlotNum];  // 各槽链表头
+    std::vector<TimerId> firing_;
+
+    std::thread* thread_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool terminate_;
+};
+
+#endif
@@ -12,12 +12,49 @@
 
 #include "lock.h"
 
-CLock::CLock() {
+#include <algorithm>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <time.h>
+
+#ifdef IH_LOCK_PROFILE
+#include <dlfcn.h>
+#endif
+
+namespace {
+// 自旋上限(尝试次数)和单次退避的最大 pause 数. 单核机器上自旋没有意义
+const int kMaxSpin = 100;
+const int kMaxBackoff = 64;
+const bool kCanSpin = std::thread::hardware_concurrency() > 1;
+}
+
+// 线程退出时归还 RCU 读者槽, 槽留给后来的线程复用
+struct CRcuThreadSlot {
+    CRcuDomain::Reader *reader_;
+
+    CRcuThreadSlot() : reader_(NULL) {}
+    ~CRcuThreadSlot() {
+        if (NULL != reader_)
+            CRcuDomain::instance().releaseReader(reader_);
+    }
+};
+
+static thread_local CRcuThreadSlot tls_rcu_slot;
+
+CLock::CLock(const char *name) {
 #ifdef _WIN32
+    (void)name;
     InitializeCriticalSection(&m_critical_section);
 #else
     pthread_mutex_init(&lock_, NULL);
 #endif
+#ifdef IH_LOCK_PROFILE
+    stats_ = CLockProfiler::getStats(name);
+    hold_start_ = 0;
+#else
+    (void)name;
+#endif
 }
 
 CLock::~CLock() {
@@ -31,25 +68,145 @@ CLock::~CLock() {
 void CLock::lock() {
 #ifdef _WIN32
     EnterCriticalSection(&m_critical_section);
+#elif defined(IH_LOCK_PROFILE)
+    lockAt(__builtin_return_address(0));
 #else
     pthread_mutex_lock(&lock_);
 #endif
 }
 
+#ifdef IH_LOCK_PROFILE
+void CLock::lockAt(void *site) {
+    // 先试一次, 拿不到才算竞争并计时
+    if (pthread_mutex_trylock(&lock_) == 0) {
+        stats_->onAcquire(false, 0, site);
+    } else {
+        uint64_t start = lockProfileNowNs();
+        pthread_mutex_lock(&lock_);
+        stats_->onAcquire(true, lockProfileNowNs() - start, site);
+    }
+    hold_start_ = lockProfileNowNs();
+}
+#endif
+
 void CLock::unlock() {
 #ifdef _WIN32
     LeaveCriticalSection(&m_critical_section);
 #else
+#ifdef IH_LOCK_PROFILE
+    stats_->onRelease(lockProfileNowNs() - hold_start_);
+#endif
     pthread_mutex_unlock(&lock_);
 #endif
 }
 
 #ifndef _WIN32
-bool CLock::try_lock() { return pthread_mutex_trylock(&lock_) == 0; }
+bool CLock::try_lock() {
+    if (pthread_mutex_trylock(&lock_) != 0)
+        return false;
+#ifdef IH_LOCK_PROFILE
+    stats_->onAcquire(false, 0, __builtin_return_address(0));
+    hold_start_ = lockProfileNowNs();
+#endif
+    return true;
+}
 #endif
 
+void CAdaptiveLock::lockSlow() {
+    if (kCanSpin) {
+        // 和 glibc 的 adaptive mutex 一样, 本次上限是平均值的两倍加 10,
+        // 之前总要等很久的锁很快就不再自旋
+        int spin = spin_.load(std::memory_order_relaxed);
+        int limit = spin * 2 + 10;
+        if (limit > kMaxSpin)
+            limit = kMaxSpin;
+
+        int cnt = 0;
+        int backoff = 1;
+        bool locked = false;
+        while (cnt < limit) {
+            ++cnt;
+            for (int i = 0; i < backoff; i++)
+                CpuRelax();
+            if (backoff < kMaxBackoff)
+                backoff <<= 1;
+
+            uint32_t c = state_.load(std::memory_order_relaxed);
+            if (c == 0 && state_.compare_exchange_weak(c, 1, std::memory_order_acquire)) {
+                locked = true;
+                break;
+            }
+        }
+
+        spin_.store(spin + (cnt - spin) / 8, std::memory_order_relaxed);
+        if (locked)
+            return;
+    }
+
+    // 睡下之前把状态置 2, 解锁方看到 2 才需要唤醒; 醒来后仍置 2, 因为可能还有别的等待者
+    uint32_t c = state_.exchange(2, std::memory_order_acquire);
+    while (c != 0) {
+        FutexWait(&state_, 2);
+        c = state_.exchange(2, std::memory_order_acquire);
+    }
+}
+
 #ifndef _WIN32
-CRWLock::CRWLock() { pthread_rwlock_init(&lock_, NULL); }
+#ifdef IH_LOCK_PROFILE
+CRWLock::CRWLock(const char *name) : stats_(CLockProfiler::getStats(name)), hold_start_(0), writer_(false) {
+    pthread_rwlock_init(&lock_, NULL);
+}
+
+CRWLock::~CRWLock() { pthread_rwlock_destroy(&lock_); }
+
+void CRWLock::rlock() {
+    if (pthread_rwlock_tryrdlock(&lock_) == 0) {
+        stats_->onAcquire(false, 0, __builtin_return_address(0));
+        return;
+    }
+    uint64_t start = lockProfileNowNs();
+    pthread_rwlock_rdlock(&lock_);
+    stats_->onAcquire(true, lockProfileNowNs() - start, __builtin_return_address(0));
+}
+
+void CRWLock::wlock() {
+    if (pthread_rwlock_trywrlock(&lock_) == 0) {
+        stats_->onAcquire(false, 0, __builtin_return_address(0));
+    } else {
+        uint64_t start = lockProfileNowNs();
+        pthread_rwlock_wrlock(&lock_);
+        stats_->onAcquire(true, lockProfileNowNs() - start, __builtin_return_address(0));
+    }
+    hold_start_ = lockProfileNowNs();
+    writer_.store(true, std::memory_order_relaxed);
+}
+
+void CRWLock::unlock() {
+    // 持有写锁时不会有读者, 看到 writer_ 的一定是写者自己
+    if (writer_.load(std::memory_order_relaxed)) {
+        writer_.store(false, std::memory_order_relaxed);
+        stats_->onRelease(lockProfileNowNs() - hold_start_);
+    }
+    pthread_rwlock_unlock(&lock_);
+}
+
+bool CRWLock::try_rlock() {
+    if (pthread_rwlock_tryrdlock(&lock_) != 0)
+        return false;
+    stats_->onAcquire(false, 0, __builtin_return_address(0));
+    return true;
+}
+
+bool CRWLock::try_wlock() {
+    if (pthread_rwlock_trywrlock(&lock_) != 0)
+        return false;
+    stats_->onAcquire(false, 0, __builtin_return_address(0));
+    hold_start_ = lockProfileNowNs();
+    writer_.store(true, std::memory_order_relaxed);
+    return true;
+}
+#else
+CRWLock::CRWLock(const char *) { pthread_rwlock_init(&lock_, NULL); }
 
 CRWLock::~CRWLock() { pthread_rwlock_destroy(&lock_); }
 
@@ -62,6 +219,7 @@ void CRWLock::unlock() { pthread_rwlock_unlock(&lock_); }
 bool CRWLock::try_rlock() { return pthread_rwlock_tryrdlock(&lock_) == 0; }
 
 bool CRWLock::try_wlock() { return pthread_rwlock_trywrlock(&lock_) == 0; }
+#endif
 
 CAutoRWLock::CAutoRWLock(CRWLock *pLock, bool bRLock) {
     lock_ = pLock;
@@ -83,11 +241,323 @@ CAutoRWLock::~CAutoRWLock() {
 
 CAutoLock::CAutoLock(CLock *pLock) {
     m_pLock = pLock;
-    if (NULL != m_pLock)
+    m_pAdaptiveLock = NULL;
+    if (NULL != m_pLock) {
+#ifdef IH_LOCK_PROFILE
+        // 记录 CAutoLock 的使用者, 而不是这里
+        m_pLock->lockAt(__builtin_return_address(0));
+#else
         m_pLock->lock();
+#endif
+    }
+}
+
+CAutoLock::CAutoLock(CAdaptiveLock *pLock) {
+    m_pLock = NULL;
+    m_pAdaptiveLock = pLock;
+    if (NULL != m_pAdaptiveLock)
+        m_pAdaptiveLock->lock();
 }
 
 CAutoLock::~CAutoLock() {
     if (NULL != m_pLock)
         m_pLock->unlock();
+    if (NULL != m_pAdaptiveLock)
+        m_pAdaptiveLock->unlock();
+}
+
+CRcuDomain &CRcuDomain::instance() {
+    // 不析构: 其他全局对象和退出中的线程可能还会用到
+    static CRcuDomain *domain = new CRcuDomain();
+    return *domain;
+}
+
+CRcuDomain::CRcuDomain() : epoch_(1), readers_(NULL) {}
+
+CRcuDomain::Reader *CRcuDomain::acquireReader() {
+    for (Reader *reader = readers_.load(std::memory_order_acquire); reader != NULL;
+         reader = reader->next_) {
+        bool used = false;
+        if (!reader->used_.load(std::memory_order_relaxed) &&
+            reader->used_.compare_exchange_strong(used, true))
+            return reader;
+    }
+
+    // 读者槽只增不减, 数量不超过同时存在过的线程数
+    Reader *reader = new Reader();
+    reader->epoch_.store(0, std::memory_order_relaxed);
+    reader->nest_ = 0;
+    reader->used_.store(true, std::memory_order_relaxed);
+    reader->next_ = readers_.load(std::memory_order_relaxed);
+    while (!readers_.compare_exchange_weak(reader->next_, reader, std::memory_order_release)) {
+    }
+    return reader;
+}
+
+void CRcuDomain::releaseReader(Reader *reader) {
+    reader->nest_ = 0;
+    reader->epoch_.store(0, std::memory_order_release);
+    reader->used_.store(false, std::memory_order_release);
+}
+
+CRcuDomain::Reader *CRcuDomain::localReader() {
+    if (NULL == tls_rcu_slot.reader_)
+        tls_rcu_slot.reader_ = acquireReader();
+    return tls_rcu_slot.reader_;
+}
+
+void CRcuDomain::readLock() {
+    Reader *reader = localReader();
+    if (reader->nest_++ == 0) {
+        // 先登记纪元再读指针; 和 retire 里推进纪元后扫描读者槽配对
+        reader->epoch_.store(epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void CRcuDomain::readUnlock() {
+    Reader *reader = localReader();
+    if (--reader->nest_ == 0)
+        reader->epoch_.store(0, std::memory_order_release);
 }
+
+void CRcuDomain::retire(void *ptr, void (*deleter)(void *)) {
+    std::vector<Retired> reclaimed;
+    {
+        CAutoLock lock(&retire_lock_);
+        // 记下推进前的纪元: 登记了更大纪元的读者进入时已经看不到这个旧对象
+        Retired item;
+        item.ptr_ = ptr;
+        item.deleter_ = deleter;
+        item.epoch_ = epoch_.fetch_add(1, std::memory_order_seq_cst);
+        retired_.push_back(item);
+        reclaim(reclaimed);
+    }
+
+    for (size_t i = 0; i < reclaimed.size(); i++)
+        reclaimed[i].deleter_(reclaimed[i].ptr_);
+}
+
+void CRcuDomain::reclaim(std::vector<Retired> &out) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = UINT64_MAX;
+    for (Reader *reader = readers_.load(std::memory_order_acquire); reader != NULL;
+         reader = reader->next_) {
+        uint64_t epoch = reader->epoch_.load(std::memory_order_acquire);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    // 纪元不大于退休纪元的读者可能还拿着旧指针
+    size_t keep = 0;
+    for (size_t i = 0; i < retired_.size(); i++) {
+        if (retired_[i].epoch_ < oldest)
+            out.push_back(retired_[i]);
+        else
+            retired_[keep++] = retired_[i];
+    }
+    retired_.resize(keep);
+}
+
+void CRcuDomain::synchronize() {
+    while (true) {
+        std::vector<Retired> reclaimed;
+        bool empty;
+        {
+            CAutoLock lock(&retire_lock_);
+            reclaim(reclaimed);
+            empty = retired_.empty();
+        }
+
+        for (size_t i = 0; i < reclaimed.size(); i++)
+            reclaimed[i].deleter_(reclaimed[i].ptr_);
+
+        if (empty)
+            break;
+        std::this_thread::yield();
+    }
+}
+
+size_t CRcuDomain::getRetiredNum() {
+    CAutoLock lock(&retire_lock_);
+    return retired_.size();
+}
+
+#ifdef IH_LOCK_PROFILE
+namespace {
+// 所有统计对象串成链表, 只增不删; 注册时加锁, 加锁解锁路径上不碰这把锁
+std::mutex g_profile_mutex;
+std::atomic<CLockStats *> g_profile_head(NULL);
+
+std::string siteSymbol(uintptr_t pc) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", (void *)pc);
+#if defined(__linux__) || defined(__APPLE__)
+    Dl_info info;
+    if (dladdr((void *)pc, &info) != 0 && info.dli_sname != NULL)
+        return std::string(info.dli_sname) + "+" +
+               std::to_string(pc - (uintptr_t)info.dli_saddr) + " (" + buf + ")";
+#endif
+    return buf;
+}
+
+bool moreContended(const CLockProfiler::Entry &a, const CLockProfiler::Entry &b) {
+    if (a.contended_ != b.contended_)
+        return a.contended_ > b.contended_;
+    return a.wait_ns_ > b.wait_ns_;
+}
+}
+
+uint64_t lockProfileNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+CLockStats::CLockStats(const std::string &name)
+    : name_(name), acquired_(0), contended_(0), wait_ns_(0), max_hold_ns_(0), next_(NULL) {
+    for (int i = 0; i < kSites; i++) {
+        site_pc_[i].store(0, std::memory_order_relaxed);
+        site_count_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void CLockStats::onAcquire(bool contended, uint64_t waitNs, void *site) {
+    acquired_.fetch_add(1, std::memory_order_relaxed);
+    if (!contended)
+        return;
+
+    uint64_t n = contended_.fetch_add(1, std::memory_order_relaxed);
+    wait_ns_.fetch_add(waitNs, std::memory_order_relaxed);
+    if ((n & kSampleMask) != 0)
+        return;
+
+    // 抽样记录调用位置, 表满后新的位置不再记录
+    uintptr_t pc = (uintptr_t)site;
+    for (int i = 0; i < kSites; i++) {
+        uintptr_t cur = site_pc_[i].load(std::memory_order_relaxed);
+        if (cur == 0 && site_pc_[i].compare_exchange_strong(cur, pc, std::memory_order_relaxed))
+            cur = pc;
+        if (cur == pc) {
+            site_count_[i].fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void CLockStats::onRelease(uint64_t holdNs) {
+    uint64_t max = max_hold_ns_.load(std::memory_order_relaxed);
+    while (holdNs > max &&
+           !max_hold_ns_.compare_exchange_weak(max, holdNs, std::memory_order_relaxed)) {
+    }
+}
+
+CLockStats *CLockProfiler::getStats(const char *name) {
+    std::string key = name != NULL ? name : "(unnamed)";
+    std::lock_guard<std::mutex> lock(g_profile_mutex);
+    for (CLockStats *stats = g_profile_head.load(); stats != NULL; stats = stats->next_) {
+        if (stats->name_ == key)
+            return stats;
+    }
+
+    CLockStats *stats = new CLockStats(key);
+    stats->next_ = g_profile_head.load();
+    g_profile_head.store(stats);
+    return stats;
+}
+
+std::vector<CLockProfiler::Entry> CLockProfiler::snapshot() {
+    std::vector<Entry> entries;
+    for (CLockStats *stats = g_profile_head.load(); stats != NULL; stats = stats->next_) {
+        Entry entry;
+        entry.name_ = stats->name_;
+        entry.acquired_ = stats->acquired_.load(std::memory_order_relaxed);
+        entry.contended_ = stats->contended_.load(std::memory_order_relaxed);
+        entry.wait_ns_ = stats->wait_ns_.load(std::memory_order_relaxed);
+        entry.max_hold_ns_ = stats->max_hold_ns_.load(std::memory_order_relaxed);
+        for (int i = 0; i < CLockStats::kSites; i++) {
+            uintptr_t pc = stats->site_pc_[i].load(std::memory_order_relaxed);
+            if (pc == 0)
+                break;
+            Site site;
+            site.symbol_ = siteSymbol(pc);
+            site.count_ = stats->site_count_[i].load(std::memory_order_relaxed);
+            entry.sites_.push_back(site);
+        }
+        entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), moreContended);
+    return entries;
+}
+
+void CLockProfiler::reset() {
+    for (CLockStats *stats = g_profile_head.load(); stats != NULL; stats = stats->next_) {
+        stats->acquired_.store(0, std::memory_order_relaxed);
+        stats->contended_.store(0, std::memory_order_relaxed);
+        stats->wait_ns_.store(0, std::memory_order_relaxed);
+        stats->max_hold_ns_.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < CLockStats::kSites; i++) {
+            stats->site_pc_[i].store(0, std::memory_order_relaxed);
+            stats->site_count_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::string CLockProfiler::dump(size_t top) {
+    std::vector<Entry> entries = snapshot();
+    std::string out;
+    char line[512];
+    for (size_t i = 0; i < entries.size() && i < top; i++) {
+        const Entry &e = entries[i];
+        snprintf(line, sizeof(line),
+                 "%-24s acquired=%llu contended=%llu wait_total_us=%llu wait_avg_ns=%llu max_hold_us=%llu\n",
+                 e.name_.c_str(), (unsigned long long)e.acquired_,
+                 (unsigned long long)e.contended_, (unsigned long long)(e.wait_ns_ / 1000),
+                 (unsigned long long)(e.contended_ == 0 ? 0 : e.wait_ns_ / e.contended_),
+                 (unsigned long long)(e.max_hold_ns_ / 1000));
+        out += line;
+        for (size_t j = 0; j < e.sites_.size(); j++) {
+            snprintf(line, sizeof(line), "    %llu  %s\n", (unsigned long long)e.sites_[j].count_,
+                     e.sites_[j].symbol_.c_str());
+            out += line;
+        }
+    }
+    return out;
+}
+
+CProfiledMutex::CProfiledMutex(const char *name)
+    : stats_(CLockProfiler::getStats(name)), hold_start_(0) {}
+
+void CProfiledMutex::lock() {
+    if (mutex_.try_lock()) {
+        stats_->onAcquire(false, 0, __builtin_return_address(0));
+    } else {
+        uint64_t start = lockProfileNowNs();
+        mutex_.lock();
+        stats_->onAcquire(true, lockProfileNowNs() - start, __builtin_return_address(0));
+    }
+    hold_start_ = lockProfileNowNs();
+}
+
+void CProfiledMutex::unlock() {
+    stats_->onRelease(lockProfileNowNs() - hold_start_);
+    mutex_.unlock();
+}
+
+bool CProfiledMutex::try_lock() {
+    if (!mutex_.try_lock())
+        return false;
+    stats_->onAcquire(false, 0, __builtin_return_address(0));
+    hold_start_ = lockProfileNowNs();
+    return true;
+}
+#else
+std::vector<CLockProfiler::Entry> CLockProfiler::snapshot() { return std::vector<Entry>(); }
+
+std::string CLockProfiler::dump(size_t) {
+    return "lock profiling is disabled, rebuild with -DIH_LOCK_PROFILE\n";
+}
+
+void CLockProfiler::reset() {}
+#endif
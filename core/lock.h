@@ -14,16 +14,87 @@
 #define __LOCK_H__
 
 #include "ostype.h"
+#include "ih_futex.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// 锁竞争统计: 编译时定义 IH_LOCK_PROFILE 打开(仅非 Windows), 未定义时锁的实现和内存布局都不变.
+// 打开后 CLock / CRWLock / CProfiledMutex 按名字汇总加锁次数, 发生竞争的次数, 等待总时长,
+// 最长持有时间, 并对竞争时的调用位置抽样. 同名的锁合并统计, 没有名字的归入 "(unnamed)"
+#if defined(IH_LOCK_PROFILE) && defined(_WIN32)
+#undef IH_LOCK_PROFILE
+#endif
+
+#ifdef IH_LOCK_PROFILE
+struct CLockStats {
+    static const int kSites = 8;        // 每把锁记录的调用位置数
+    static const int kSampleMask = 7;   // 每 8 次竞争抽样一次调用位置
+
+    explicit CLockStats(const std::string &name);
+    void onAcquire(bool contended, uint64_t waitNs, void *site);
+    void onRelease(uint64_t holdNs);
+
+    std::string name_;
+    std::atomic<uint64_t> acquired_;
+    std::atomic<uint64_t> contended_;
+    std::atomic<uint64_t> wait_ns_;
+    std::atomic<uint64_t> max_hold_ns_;
+    std::atomic<uintptr_t> site_pc_[kSites];
+    std::atomic<uint64_t> site_count_[kSites];
+    CLockStats *next_;
+};
+
+uint64_t lockProfileNowNs();
+#endif
+
+class CLockProfiler {
+  public:
+    struct Site {
+        std::string symbol_;    // 解析不出符号时为十六进制地址
+        uint64_t count_;
+    };
+
+    struct Entry {
+        std::string name_;
+        uint64_t acquired_;
+        uint64_t contended_;
+        uint64_t wait_ns_;
+        uint64_t max_hold_ns_;
+        std::vector<Site> sites_;
+    };
+
+    // 按竞争次数从多到少排序; 未打开统计时为空
+    static std::vector<Entry> snapshot();
+    // 竞争最多的 top 把锁, 每行一把, 附带抽样到的调用位置
+    static std::string dump(size_t top = 10);
+    static void reset();
+#ifdef IH_LOCK_PROFILE
+    // 取同名锁共用的统计对象, 只在构造锁时调用
+    static CLockStats *getStats(const char *name);
+#endif
+};
 
 class CLock {
   public:
-    CLock();
+    // name 只用于竞争统计
+    CLock(const char *name = NULL);
     virtual ~CLock();
     void lock();
     void unlock();
     pthread_mutex_t &getMutex() { return lock_; }
 #ifndef _WIN32
     virtual bool try_lock();
+#endif
+#ifdef IH_LOCK_PROFILE
+    // site 为加锁的调用位置
+    void lockAt(void *site);
 #endif
   private:
 #ifdef _WIN32
@@ -31,12 +102,51 @@ class CLock {
 #else
     pthread_mutex_t lock_;
 #endif
+#ifdef IH_LOCK_PROFILE
+    CLockStats *stats_;
+    uint64_t hold_start_;
+#endif
+};
+
+// 非虚的自适应互斥锁: 先带指数退避自旋, 拿不到再睡在 futex 上.
+// 无竞争时加锁解锁各一次原子操作, 不进内核; 自旋次数按最近几次加锁实际等待的长度自动调整.
+// 接口和 std::mutex 一致, 可以配合 CAutoLock 或 std::lock_guard 使用
+class CAdaptiveLock {
+  public:
+    CAdaptiveLock() : state_(0), spin_(0) {}
+
+    void lock() {
+        uint32_t c = 0;
+        if (!state_.compare_exchange_strong(c, 1, std::memory_order_acquire))
+            lockSlow();
+    }
+
+    void unlock() {
+        // 2 表示可能有线程睡在锁上
+        if (state_.exchange(0, std::memory_order_release) == 2)
+            FutexWake(&state_, 1);
+    }
+
+    bool try_lock() {
+        uint32_t c = 0;
+        return state_.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+
+  private:
+    CAdaptiveLock(const CAdaptiveLock &);
+    CAdaptiveLock &operator=(const CAdaptiveLock &);
+
+    void lockSlow();
+
+    std::atomic<uint32_t> state_;   // 0 未加锁, 1 已加锁, 2 已加锁且有等待者
+    std::atomic<int> spin_;         // 自旋次数的滑动平均
 };
 
 #ifndef _WIN32
 class CRWLock {
   public:
-    CRWLock();
+    // name 只用于竞争统计. 持有时间只统计写锁
+    CRWLock(const char *name = NULL);
     virtual ~CRWLock();
     void rlock();
     void wlock();
@@ -46,6 +156,11 @@ class CRWLock {
 
   private:
     pthread_rwlock_t lock_;
+#ifdef IH_LOCK_PROFILE
+    CLockStats *stats_;
+    uint64_t hold_start_;
+    std::atomic<bool> writer_;
+#endif
 };
 
 class CAutoRWLock {
@@ -62,10 +177,282 @@ class CAutoRWLock {
 class CAutoLock {
   public:
     CAutoLock(CLock *pLock);
+    CAutoLock(CAdaptiveLock *pLock);
     virtual ~CAutoLock();
 
   private:
     CLock *m_pLock;
+    CAdaptiveLock *m_pAdaptiveLock;
+};
+
+// 可以命名的 std::mutex, 能配合 std::lock_guard / std::unique_lock 使用(条件变量需用
+// std::condition_variable_any). 未打开竞争统计时就是 std::mutex
+#ifdef IH_LOCK_PROFILE
+class CProfiledMutex {
+  public:
+    explicit CProfiledMutex(const char *name = NULL);
+    void lock();
+    void unlock();
+    bool try_lock();
+
+  private:
+    CProfiledMutex(const CProfiledMutex &);
+    CProfiledMutex &operator=(const CProfiledMutex &);
+
+    std::mutex mutex_;
+    CLockStats *stats_;
+    uint64_t hold_start_;
+};
+#else
+class CProfiledMutex : public std::mutex {
+  public:
+    explicit CProfiledMutex(const char * = NULL) {}
+};
+#endif
+
+// 分段锁表: 固定数量的锁按 key 的哈希分段, 同一个 key 总落在同一把锁上, 不同 key 大多互不干扰.
+// 用于按 key 串行化的场景(比如同一个文件 md5 的删除, 分享, 计数), 不需要为每个 key 建锁,
+// 也不需要一把全局锁. 每段独占缓存行, 相邻段不会伪共享. 段数按 2 的幂向上取整
+//
+//     static CStripedLock<> g_file_locks(1024);
+//     CStripedLock<>::Guard guard(g_file_locks, md5);
+template <class Mutex = CAdaptiveLock>
+class CStripedLock {
+  public:
+    explicit CStripedLock(size_t stripes = 256) {
+        size_t num = 1;
+        while (num < stripes)
+            num *= 2;
+        mask_ = num - 1;
+        stripes_.reset(new Stripe[num]);
+    }
+
+    size_t size() const { return mask_ + 1; }
+
+    size_t index(const char *key, size_t len) const { return mix(hashBytes(key, len)) & mask_; }
+    size_t index(const std::string &key) const { return index(key.data(), key.size()); }
+    size_t index(uint64_t key) const { return mix(key) & mask_; }
+
+    Mutex &get(const char *key, size_t len) { return stripes_[index(key, len)].lock_; }
+    Mutex &get(const std::string &key) { return stripes_[index(key)].lock_; }
+    Mutex &get(uint64_t key) { return stripes_[index(key)].lock_; }
+    Mutex &at(size_t index) { return stripes_[index & mask_].lock_; }
+
+    // 锁住一个 key 所在的段
+    class Guard {
+      public:
+        template <class Key>
+        Guard(CStripedLock &table, const Key &key) : lock_(&table.get(key)) { lock_->lock(); }
+        ~Guard() { lock_->unlock(); }
+
+      private:
+        Guard(const Guard &);
+        Guard &operator=(const Guard &);
+
+        Mutex *lock_;
+    };
+
+    // 同时锁住两个 key(比如把计数从一个文件转到另一个), 按段号从小到大加锁避免死锁,
+    // 两个 key 落在同一段时只加一次
+    class PairGuard {
+      public:
+        template <class Key>
+        PairGuard(CStripedLock &table, const Key &key1, const Key &key2) {
+            size_t i = table.index(key1);
+            size_t j = table.index(key2);
+            if (i > j)
+                std::swap(i, j);
+            first_ = &table.at(i);
+            second_ = i == j ? NULL : &table.at(j);
+            first_->lock();
+            if (second_)
+                second_->lock();
+        }
+        ~PairGuard() {
+            if (second_)
+                second_->unlock();
+            first_->unlock();
+        }
+
+      private:
+        PairGuard(const PairGuard &);
+        PairGuard &operator=(const PairGuard &);
+
+        Mutex *first_;
+        Mutex *second_;
+    };
+
+  private:
+    CStripedLock(const CStripedLock &);
+    CStripedLock &operator=(const CStripedLock &);
+
+    struct alignas(64) Stripe {
+        Mutex lock_;
+    };
+
+    // FNV-1a
+    static uint64_t hashBytes(const char *key, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; i++) {
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // 打散低位, 连续的整数 id 和只有高位不同的哈希也能均匀分段
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    std::unique_ptr<Stripe[]> stripes_;
+    size_t mask_;
+};
+
+// 顺序锁: 保存一个小的 POD 快照(配置项, 计数器组等), 读远多于写的场景.
+// 读者不加锁也不做原子读改写, 只读两次序号, 读的过程中有写入就重读;
+// 写者之间用 CAdaptiveLock 互斥. 数据按 8 字节原子字保存, 读到一半被改写也不是数据竞争
+template <class T>
+class CSeqLock {
+  public:
+    CSeqLock() : seq_(0) { write(T()); }
+
+    explicit CSeqLock(const T &value) : seq_(0) { write(value); }
+
+    T read() const {
+        uint64_t buf[kWords];
+        uint32_t seq;
+        while (true) {
+            seq = seq_.load(std::memory_order_acquire);
+            if (seq & 1) {
+                CpuRelax();
+                continue;
+            }
+            for (size_t i = 0; i < kWords; i++)
+                buf[i] = words_[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == seq)
+                break;
+        }
+
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+    void write(const T &value) {
+        uint64_t buf[kWords] = {0};
+        memcpy(buf, &value, sizeof(T));
+
+        CAutoLock lock(&write_lock_);
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kWords; i++)
+            words_[i].store(buf[i], std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+  private:
+    static_assert(std::is_trivially_copyable<T>::value, "CSeqLock needs a trivially copyable type");
+    static const size_t kWords = (sizeof(T) + 7) / 8;
+
+    std::atomic<uint32_t> seq_;    // 奇数表示正在写
+    std::atomic<uint64_t> words_[kWords];
+    CAdaptiveLock write_lock_;
+};
+
+// 基于纪元(epoch)的 RCU, 用于读多写少的较大结构(连接池表, 分享链接表等).
+// 读者在 CRcuReadGuard 范围内通过 CRcuPtr::get 拿指针, 只写自己线程的纪元槽, 没有原子读改写;
+// 写者用 CRcuPtr::update 发布新版本, 旧版本等所有可能还在读它的读者离开后再删除, 写者不等待.
+//
+//     CRcuPtr<PoolMap> pools(new PoolMap());
+//     {
+//         CRcuReadGuard guard;
+//         PoolMap *map = pools.get();   // 在 guard 范围内有效
+//     }
+//     pools.update(newMap);
+class CRcuDomain {
+  public:
+    static CRcuDomain &instance();
+
+    // 可以嵌套. 读临界区内不能阻塞太久, 否则旧版本一直不能回收
+    void readLock();
+    void readUnlock();
+
+    // 旧对象在当前所有读者离开后由 deleter 释放
+    void retire(void *ptr, void (*deleter)(void *));
+    // 阻塞到此前退休的对象全部释放, 用于退出前或测试. 不能在读临界区内调用
+    void synchronize();
+    size_t getRetiredNum();
+
+  private:
+    struct Reader {
+        std::atomic<uint64_t> epoch_;   // 0 表示不在读临界区
+        int nest_;
+        std::atomic<bool> used_;
+        Reader *next_;
+        char pad_[64];                  // 各线程的槽不共享缓存行
+    };
+
+    struct Retired {
+        void *ptr_;
+        void (*deleter_)(void *);
+        uint64_t epoch_;
+    };
+
+    friend struct CRcuThreadSlot;
+
+    CRcuDomain();
+    Reader *acquireReader();
+    void releaseReader(Reader *reader);
+    Reader *localReader();
+    // 调用者持有 retire_lock_, 把可以释放的对象移到 out 里, 解锁后再释放
+    void reclaim(std::vector<Retired> &out);
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<Reader *> readers_;
+    CAdaptiveLock retire_lock_;
+    std::vector<Retired> retired_;
+};
+
+class CRcuReadGuard {
+  public:
+    CRcuReadGuard() { CRcuDomain::instance().readLock(); }
+    ~CRcuReadGuard() { CRcuDomain::instance().readUnlock(); }
+
+  private:
+    CRcuReadGuard(const CRcuReadGuard &);
+    CRcuReadGuard &operator=(const CRcuReadGuard &);
+};
+
+template <class T>
+class CRcuPtr {
+  public:
+    explicit CRcuPtr(T *ptr = NULL) : ptr_(ptr) {}
+    // 析构时不应再有读者
+    ~CRcuPtr() { delete ptr_.load(std::memory_order_relaxed); }
+
+    // 只能在 CRcuReadGuard 范围内使用返回的指针
+    T *get() const { return ptr_.load(std::memory_order_acquire); }
+
+    // 发布新版本, 旧版本延迟删除. 多个写者同时更新时各自的旧版本都会被回收
+    void update(T *ptr) {
+        T *old = ptr_.exchange(ptr, std::memory_order_seq_cst);
+        if (old != NULL)
+            CRcuDomain::instance().retire(old, &Delete);
+    }
+
+  private:
+    CRcuPtr(const CRcuPtr &);
+    CRcuPtr &operator=(const CRcuPtr &);
+
+    static void Delete(void *ptr) { delete static_cast<T *>(ptr); }
+
+    std::atomic<T *> ptr_;
 };
 
 #endif
@@ -1,40 +1,19 @@
 #include "util.h"
 #include <sstream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FIND_HAS_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FIND_HAS_SIMD
+#endif
 using namespace std;
 
-CRefObject::CRefObject() {
-    lock_ = NULL;
-    ref_count_ = 1;
-}
+CRefObject::CRefObject() : ref_count_(1) {}
 
 CRefObject::~CRefObject() {}
 
-void CRefObject::AddRef() {
-    if (lock_) {
-        lock_->lock();
-        ref_count_++;
-        lock_->unlock();
-    } else {
-        ref_count_++;
-    }
-}
-
-void CRefObject::ReleaseRef() {
-    if (lock_) {
-        lock_->lock();
-        ref_count_--;
-        if (ref_count_ == 0) {
-            delete this;
-            return;
-        }
-        lock_->unlock();
-    } else {
-        ref_count_--;
-        if (ref_count_ == 0)
-            delete this;
-    }
-}
-
 uint64_t GetTickCount() {
 #ifdef _WIN32
     LARGE_INTEGER liCounter;
@@ -65,48 +44,27 @@ void util_sleep(uint32_t millisecond) {
 }
 
 CStrExplode::CStrExplode(char *str, char seperator) {
-    item_cnt_ = 1;
-    char *pos = str;
-    while (*pos) {
-        if (*pos == seperator) {
-            item_cnt_++;
-        }
-
-        pos++;
-    }
+    size_t len = strlen(str);
+    buffer_ = new char[len + 1];
+    memcpy(buffer_, str, len + 1);
 
+    CStrSplit split(std::string_view(buffer_, len), std::string_view(&seperator, 1),
+                    STR_SPLIT_SKIP_EMPTY);
+    item_cnt_ = (uint32_t)split.Count();
     item_list_ = new char *[item_cnt_];
 
-    int idx = 0;
-    char *start = pos = str;
-    while (*pos) {
-        if (pos != start && *pos == seperator) {
-            uint32_t len = pos - start;
-            item_list_[idx] = new char[len + 1];
-            strncpy(item_list_[idx], start, len);
-            item_list_[idx][len] = '\0';
-            idx++;
-
-            start = pos + 1;
-        }
-
-        pos++;
-    }
-
-    uint32_t len = pos - start;
-    if (len != 0) {
-        item_list_[idx] = new char[len + 1];
-        strncpy(item_list_[idx], start, len);
-        item_list_[idx][len] = '\0';
+    // 各项末尾的分隔符改成 '\0', 切分器已经越过这些位置, 不影响后面的查找
+    uint32_t idx = 0;
+    for (CStrSplit::Iterator it = split.begin(); it != split.end(); ++it) {
+        char *item = buffer_ + (it->data() - buffer_);
+        item[it->size()] = '\0';
+        item_list_[idx++] = item;
     }
 }
 
 CStrExplode::~CStrExplode() {
-    for (uint32_t i = 0; i < item_cnt_; i++) {
-        delete[] item_list_[i];
-    }
-
     delete[] item_list_;
+    delete[] buffer_;
 }
 
 char *ReplaceStr(char *src, char old_char, char new_char) {
@@ -184,44 +142,163 @@ inline unsigned char FromHex(const unsigned char &x) {
     return isdigit(x) ? x - '0' : x - 'A' + 10;
 }
 
-string URLEncode(const string &in) {
-    string out;
-    for (size_t ix = 0; ix < in.size(); ix++) {
-        unsigned char buf[4];
-        memset(buf, 0, 4);
-        if (isalnum((unsigned char)in[ix])) {
-            buf[0] = in[ix];
+namespace {
+const char kHexDigits[] = "0123456789ABCDEF";
+
+// kUrlSafe: 编码时原样保留的字符; kHexValue: 十六进制字符的值, 非法为 -1
+struct UrlTables {
+    bool safe[256];
+    int8_t hex[256];
+
+    UrlTables() {
+        for (int c = 0; c < 256; c++) {
+            safe[c] = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            hex[c] = -1;
         }
-        // else if ( isspace( (unsigned char)in[ix] ) )
-        // //貌似把空格编码成%20或者+都可以
-        //{
-        //     buf[0] = '+';
-        // }
-        else {
-            buf[0] = '%';
-            buf[1] = ToHex((unsigned char)in[ix] >> 4);
-            buf[2] = ToHex((unsigned char)in[ix] % 16);
+        for (int c = 0; c < 10; c++)
+            hex['0' + c] = c;
+        for (int c = 0; c < 6; c++) {
+            hex['a' + c] = 10 + c;
+            hex['A' + c] = 10 + c;
         }
-        out += (char *)buf;
     }
+};
+const UrlTables g_url;
+
+// 开头连续有多少个不需要转义的字节
+size_t UrlSafeRun(const char *in, size_t len) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_set1_epi8('0'), nine = _mm256_set1_epi8(9);
+    const __m256i lower = _mm256_set1_epi8(0x20), a = _mm256_set1_epi8('a'), z = _mm256_set1_epi8(25);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        // 无符号范围判断: x - lo <= hi - lo 等价于 min(x - lo, hi - lo) == x - lo
+        __m256i d = _mm256_sub_epi8(v, zero);
+        d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+        __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, lower), a);
+        l = _mm256_cmpeq_epi8(_mm256_min_epu8(l, z), l);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(d, l));
+        if (mask != 0xffffffff)
+            return i + __builtin_ctz(~mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+    const __m128i lower = _mm_set1_epi8(0x20), a = _mm_set1_epi8('a'), z = _mm_set1_epi8(25);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i d = _mm_sub_epi8(v, zero);
+        d = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        __m128i l = _mm_sub_epi8(_mm_or_si128(v, lower), a);
+        l = _mm_cmpeq_epi8(_mm_min_epu8(l, z), l);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(d, l));
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask);
+    }
+#endif
+    while (i < len && g_url.safe[(unsigned char)in[i]])
+        i++;
+    return i;
+}
+
+// 开头连续有多少个解码时原样保留的字节(不是 '%' 也不是 '+')
+size_t UrlPlainRun(const char *in, size_t len) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i pct = _mm256_set1_epi8('%'), plus = _mm256_set1_epi8('+');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, pct), _mm256_cmpeq_epi8(v, plus)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i pct = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, plus)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < len && in[i] != '%' && in[i] != '+')
+        i++;
+    return i;
+}
+} // namespace
+
+int64_t URLEncode(const char *in, size_t len, char *out, size_t out_size) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        size_t run = UrlSafeRun(in + i, len - i);
+        if (o + run > out_size)
+            return -1;
+        memcpy(out + o, in + i, run);
+        i += run;
+        o += run;
+
+        // 需要转义的字节往往成片出现(比如中文文件名), 逐个处理到下一个安全字节
+        while (i < len && !g_url.safe[(unsigned char)in[i]]) {
+            if (o + 3 > out_size)
+                return -1;
+            unsigned char c = in[i++];
+            out[o] = '%';
+            out[o + 1] = kHexDigits[c >> 4];
+            out[o + 2] = kHexDigits[c & 15];
+            o += 3;
+        }
+    }
+    return o;
+}
+
+int64_t URLDecode(const char *in, size_t len, char *out, size_t out_size) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        size_t run = UrlPlainRun(in + i, len - i);
+        if (o + run > out_size)
+            return -1;
+        memcpy(out + o, in + i, run);
+        i += run;
+        o += run;
+
+        // 连续的转义逐个处理, 直到下一个普通字节
+        while (i < len && (in[i] == '%' || in[i] == '+')) {
+            if (o + 1 > out_size)
+                return -1;
+            if (in[i] == '+') {
+                out[o++] = ' ';
+                i++;
+                continue;
+            }
+
+            if (i + 2 >= len)
+                return -1;
+            int hi = g_url.hex[(unsigned char)in[i + 1]];
+            int lo = g_url.hex[(unsigned char)in[i + 2]];
+            if (hi < 0 || lo < 0)
+                return -1;
+            out[o++] = (char)((hi << 4) | lo);
+            i += 3;
+        }
+    }
+    return o;
+}
+
+string URLEncode(const string &in) {
+    string out;
+    out.resize(in.size() * 3);
+    int64_t len = URLEncode(in.data(), in.size(), &out[0], out.size());
+    out.resize(len);
     return out;
 }
 
 string URLDecode(const string &in) {
     string out;
-    for (size_t ix = 0; ix < in.size(); ix++) {
-        unsigned char ch = 0;
-        if (in[ix] == '%') {
-            ch = (FromHex(in[ix + 1]) << 4);
-            ch |= FromHex(in[ix + 2]);
-            ix += 2;
-        } else if (in[ix] == '+') {
-            ch = ' ';
-        } else {
-            ch = in[ix];
-        }
-        out += (char)ch;
-    }
+    out.resize(in.size());
+    int64_t len = URLDecode(in.data(), in.size(), &out[0], out.size());
+    out.resize(len < 0 ? 0 : len);
     return out;
 }
 
@@ -236,36 +313,146 @@ int64_t GetFileSize(const char *path) {
     return filesize;
 }
 
+namespace {
+#if defined(__AVX2__)
+const size_t kFindBlock = 32;
+typedef __m256i FindVec;
+inline FindVec FindSplat(char c) { return _mm256_set1_epi8(c); }
+// 从 a 开始的每个位置, 首字节和末字节(b 为 a + m - 1)都对上的置位
+inline uint32_t FindMask(const char *a, const char *b, FindVec first, FindVec last) {
+    FindVec x = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a), first);
+    FindVec y = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)b), last);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(x, y));
+}
+#elif defined(__SSE2__)
+const size_t kFindBlock = 16;
+typedef __m128i FindVec;
+inline FindVec FindSplat(char c) { return _mm_set1_epi8(c); }
+inline uint32_t FindMask(const char *a, const char *b, FindVec first, FindVec last) {
+    FindVec x = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), first);
+    FindVec y = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)b), last);
+    return (uint32_t)_mm_movemask_epi8(_mm_and_si128(x, y));
+}
+#endif
+
+// 要求 1 <= m <= n
+const char *FindForward(const char *s, size_t n, const char *p, size_t m) {
+    size_t end = n - m + 1;   // 可能的起始位置数
+    size_t i = 0;
+#ifdef FIND_HAS_SIMD
+    FindVec first = FindSplat(p[0]), last = FindSplat(p[m - 1]);
+    for (; i + kFindBlock <= end; i += kFindBlock) {
+        uint32_t mask = FindMask(s + i, s + i + m - 1, first, last);
+        while (mask != 0) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(s + pos, p, m) == 0)
+                return s + pos;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        if (s[i] == p[0] && s[i + m - 1] == p[m - 1] && memcmp(s + i, p, m) == 0)
+            return s + i;
+    }
+    return NULL;
+}
+
+const char *FindReverse(const char *s, size_t n, const char *p, size_t m) {
+    size_t end = n - m + 1;
+#ifdef FIND_HAS_SIMD
+    FindVec first = FindSplat(p[0]), last = FindSplat(p[m - 1]);
+    for (; end >= kFindBlock; end -= kFindBlock) {
+        size_t i = end - kFindBlock;
+        uint32_t mask = FindMask(s + i, s + i + m - 1, first, last);
+        while (mask != 0) {
+            int bit = 31 - __builtin_clz(mask);
+            if (memcmp(s + i + bit, p, m) == 0)
+                return s + i + bit;
+            mask &= ~(1u << bit);
+        }
+    }
+#endif
+    while (end > 0) {
+        size_t i = --end;
+        if (s[i] == p[0] && s[i + m - 1] == p[m - 1] && memcmp(s + i, p, m) == 0)
+            return s + i;
+    }
+    return NULL;
+}
+} // namespace
+
 const char *MemFind(const char *src_str, size_t src_len, const char *sub_str,
                     size_t sub_len, bool flag) {
-    if (NULL == src_str || NULL == sub_str || src_len <= 0) {
+    if (NULL == src_str || NULL == sub_str || src_len == 0) {
         return NULL;
     }
+    if (sub_len == 0)
+        sub_len = strlen(sub_str);
     if (src_len < sub_len) {
         return NULL;
     }
-    const char *p;
     if (sub_len == 0)
-        sub_len = strlen(sub_str);
-    if (src_len == sub_len) {
-        if (0 == (memcmp(src_str, sub_str, src_len))) {
-            return src_str;
-        } else {
-            return NULL;
-        }
+        return flag ? src_str : src_str + src_len;
+
+    if (flag)
+        return FindForward(src_str, src_len, sub_str, sub_len);
+    return FindReverse(src_str, src_len, sub_str, sub_len);
+}
+
+CMemSearcher::CMemSearcher(const char *pattern, size_t len) : pattern_(pattern, len) { Init(); }
+
+CMemSearcher::CMemSearcher(const string &pattern) : pattern_(pattern) { Init(); }
+
+void CMemSearcher::Init() {
+    size_t m = pattern_.size();
+    const unsigned char *p = (const unsigned char *)pattern_.data();
+    for (int c = 0; c < 256; c++) {
+        skip_[c] = (uint32_t)m;
+        rskip_[c] = (uint32_t)m;
     }
-    if (flag) {
-        for (int i = 0; i < src_len - sub_len; i++) {
-            p = src_str + i;
-            if (0 == memcmp(p, sub_str, sub_len))
-                return p;
-        }
-    } else {
-        for (int i = (src_len - sub_len); i >= 0; i--) {
-            p = src_str + i;
-            if (0 == memcmp(p, sub_str, sub_len))
-                return p;
-        }
+    // 末字节不参与正向表, 首字节不参与反向表, 否则匹配后无法前进
+    for (size_t j = 0; j + 1 < m; j++)
+        skip_[p[j]] = (uint32_t)(m - 1 - j);
+    for (size_t j = m - 1; j > 0; j--)
+        rskip_[p[j]] = (uint32_t)j;
+}
+
+const char *CMemSearcher::Find(const char *src, size_t len) const {
+    size_t m = pattern_.size();
+    if (src == NULL || len < m)
+        return NULL;
+    if (m == 0)
+        return src;
+
+    const char *p = pattern_.data();
+    char tail = p[m - 1];
+    for (size_t i = 0; i + m <= len;) {
+        unsigned char c = (unsigned char)src[i + m - 1];
+        if (c == (unsigned char)tail && memcmp(src + i, p, m - 1) == 0)
+            return src + i;
+        i += skip_[c];
+    }
+    return NULL;
+}
+
+const char *CMemSearcher::RFind(const char *src, size_t len) const {
+    size_t m = pattern_.size();
+    if (src == NULL || len < m)
+        return NULL;
+    if (m == 0)
+        return src + len;
+
+    const char *p = pattern_.data();
+    // i 为窗口起点 + 1, 避免无符号数减到负
+    for (size_t i = len - m + 1; i > 0;) {
+        unsigned char c = (unsigned char)src[i - 1];
+        if (c == (unsigned char)p[0] && memcmp(src + i, p + 1, m - 1) == 0)
+            return src + i - 1;
+        size_t step = rskip_[c];
+        if (step >= i)
+            break;
+        i -= step;
     }
     return NULL;
-}
\ No newline at end of file
+}
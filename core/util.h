@@ -6,6 +6,7 @@
 #include "lock.h"
 #include "ostype.h"
 #include "util_pdu.h"
+#include <atomic>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,7 +15,10 @@
 #endif
 
 #include <assert.h>
+#include <iterator>
+#include <string_view>
 #include <sys/stat.h>
+#include <utility>
 
 #ifdef _WIN32
 #define snprintf sprintf_s
@@ -29,23 +33,191 @@
     ((void)v) // used this to remove warning C4100, unreferenced parameter
 
 /// yunfan modify end
+// 侵入式引用计数, 创建时计数为 1, 减到 0 时 delete this. 计数是原子的, 可以跨线程增减
 class CRefObject {
   public:
     CRefObject();
     virtual ~CRefObject();
 
-    void SetLock(CLock *lock) { lock_ = lock; }
-    void AddRef();
-    void ReleaseRef();
+    // 计数已改为原子操作, 不再需要外部锁, 保留接口只为兼容
+    void SetLock(CLock *lock) { NOTUSED_ARG(lock); }
+    void AddRef() { ref_count_.fetch_add(1, std::memory_order_relaxed); }
+    void ReleaseRef() {
+        // release 保证本线程对对象的修改先于计数减少, 最后一个释放者 acquire 后再析构
+        if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+    // 只用于调试和断言, 并发时只是近似值
+    int GetRefCount() const { return ref_count_.load(std::memory_order_relaxed); }
+    // 只有调用方一个引用时返回 true, 可以就地修改对象. acquire 保证看到其他线程释放引用前的所有写入
+    bool IsUnique() const { return ref_count_.load(std::memory_order_acquire) == 1; }
 
   private:
-    int ref_count_;
-    CLock *lock_;
+    CRefObject(const CRefObject &);
+    CRefObject &operator=(const CRefObject &);
+
+    std::atomic<int> ref_count_;
+};
+
+// 持有侵入式引用的智能指针, T 需要提供 AddRef / ReleaseRef(如 CRefObject 的子类).
+// 裸指针构造时默认加一次引用; 接管 new 出来的对象(计数已是 1)用 MakeIntrusive 或 add_ref = false
+//
+//     IntrusivePtr<CConn> conn = MakeIntrusive<CConn>(fd);
+//     IntrusivePtr<CConn> other = conn;   // 计数 2
+template <class T> class IntrusivePtr {
+  public:
+    IntrusivePtr() : ptr_(NULL) {}
+    IntrusivePtr(T *ptr, bool add_ref = true) : ptr_(ptr) {
+        if (ptr_ && add_ref)
+            ptr_->AddRef();
+    }
+    IntrusivePtr(const IntrusivePtr &other) : ptr_(other.ptr_) {
+        if (ptr_)
+            ptr_->AddRef();
+    }
+    template <class U> IntrusivePtr(const IntrusivePtr<U> &other) : ptr_(other.get()) {
+        if (ptr_)
+            ptr_->AddRef();
+    }
+    IntrusivePtr(IntrusivePtr &&other) noexcept : ptr_(other.ptr_) { other.ptr_ = NULL; }
+    ~IntrusivePtr() {
+        if (ptr_)
+            ptr_->ReleaseRef();
+    }
+
+    IntrusivePtr &operator=(const IntrusivePtr &other) {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+    IntrusivePtr &operator=(IntrusivePtr &&other) noexcept {
+        IntrusivePtr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void reset(T *ptr = NULL, bool add_ref = true) { IntrusivePtr(ptr, add_ref).swap(*this); }
+    // 交出引用, 调用方负责之后的 ReleaseRef
+    T *detach() {
+        T *ptr = ptr_;
+        ptr_ = NULL;
+        return ptr;
+    }
+    void swap(IntrusivePtr &other) noexcept { std::swap(ptr_, other.ptr_); }
+
+    T *get() const { return ptr_; }
+    T &operator*() const { return *ptr_; }
+    T *operator->() const { return ptr_; }
+    explicit operator bool() const { return ptr_ != NULL; }
+
+  private:
+    T *ptr_;
 };
 
+template <class T, class U>
+inline bool operator==(const IntrusivePtr<T> &a, const IntrusivePtr<U> &b) {
+    return a.get() == b.get();
+}
+template <class T, class U>
+inline bool operator!=(const IntrusivePtr<T> &a, const IntrusivePtr<U> &b) {
+    return a.get() != b.get();
+}
+
+template <class T, class... Args> inline IntrusivePtr<T> MakeIntrusive(Args &&...args) {
+    return IntrusivePtr<T>(new T(std::forward<Args>(args)...), false);
+}
+
 uint64_t GetTickCount();
 void util_sleep(uint32_t millisecond);
 
+// 空字段(两个分隔符相邻, 或分隔符在首尾)的处理方式
+enum StrSplitEmpty {
+    STR_SPLIT_KEEP_EMPTY = 0,
+    STR_SPLIT_SKIP_EMPTY = 1,
+};
+
+// 不拥有数据的切分器, 遍历时逐个给出 string_view, 不分配内存, 可以在 constexpr 中使用.
+// 分隔符可以是多个字符, 为空时整串作为一项. 切出的 string_view 指向原串, 原串要比它们活得久
+//
+//     for (std::string_view kv : CStrSplit(cookie, "; ")) { ... }
+//     static_assert(CStrSplit("a,b,,c", ",", STR_SPLIT_SKIP_EMPTY).Count() == 3, "");
+class CStrSplit {
+  public:
+    class Iterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::string_view value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const std::string_view *pointer;
+        typedef const std::string_view &reference;
+
+        constexpr Iterator() : split_(NULL), pos_(kEnd), token_() {}
+        constexpr explicit Iterator(const CStrSplit *split) : split_(split), pos_(0), token_() {
+            Next();
+        }
+
+        constexpr reference operator*() const { return token_; }
+        constexpr pointer operator->() const { return &token_; }
+        constexpr Iterator &operator++() {
+            Next();
+            return *this;
+        }
+        constexpr Iterator operator++(int) {
+            Iterator it = *this;
+            Next();
+            return it;
+        }
+        constexpr bool operator==(const Iterator &other) const { return pos_ == other.pos_; }
+        constexpr bool operator!=(const Iterator &other) const { return pos_ != other.pos_; }
+
+      private:
+        static const size_t kEnd = std::string_view::npos;
+
+        // pos_ 为剩余部分的起点, 最后一项切出后为 size() + 1, 再往后为 kEnd
+        constexpr void Next() {
+            const std::string_view &str = split_->str_;
+            const std::string_view &sep = split_->sep_;
+            do {
+                if (pos_ > str.size()) {
+                    pos_ = kEnd;
+                    return;
+                }
+                size_t hit = sep.empty() ? std::string_view::npos : str.find(sep, pos_);
+                if (hit == std::string_view::npos) {
+                    token_ = str.substr(pos_);
+                    pos_ = str.size() + 1;
+                } else {
+                    token_ = str.substr(pos_, hit - pos_);
+                    pos_ = hit + sep.size();
+                }
+            } while (split_->empty_ == STR_SPLIT_SKIP_EMPTY && token_.empty());
+        }
+
+        const CStrSplit *split_;
+        size_t pos_;
+        std::string_view token_;
+    };
+
+    constexpr CStrSplit(std::string_view str, std::string_view sep,
+                        StrSplitEmpty empty = STR_SPLIT_KEEP_EMPTY)
+        : str_(str), sep_(sep), empty_(empty) {}
+
+    constexpr Iterator begin() const { return Iterator(this); }
+    constexpr Iterator end() const { return Iterator(); }
+
+    // 会完整遍历一次
+    constexpr size_t Count() const {
+        size_t cnt = 0;
+        for (Iterator it = begin(); it != end(); ++it)
+            cnt++;
+        return cnt;
+    }
+
+  private:
+    std::string_view str_;
+    std::string_view sep_;
+    StrSplitEmpty empty_;
+};
+
+// 兼容旧接口, 新代码用 CStrSplit. 整串复制一份, 各项直接指向副本, 只分配两次; 空字段跳过
 class CStrExplode {
   public:
     CStrExplode(char *str, char seperator);
@@ -55,8 +227,12 @@ class CStrExplode {
     char *GetItem(uint32_t idx) { return item_list_[idx]; }
 
   private:
+    CStrExplode(const CStrExplode &);
+    CStrExplode &operator=(const CStrExplode &);
+
     uint32_t item_cnt_;
     char **item_list_;
+    char *buffer_;
 };
 
 char *ReplaceStr(char *src, char old_char, char new_char);
@@ -68,11 +244,39 @@ void ReplaceMark(string &str, uint32_t new_value, uint32_t &begin_pos);
 void WritePid();
 inline unsigned char ToHex(const unsigned char &x);
 inline unsigned char FromHex(const unsigned char &x);
+// 字母和数字原样保留, 其他字节编码成 %XX(大写)
 string URLEncode(const string &sIn);
+// %XX 大小写都接受, '+' 解码成空格; 有不完整或非法的 %XX 时返回空串
 string URLDecode(const string &sIn);
+// 写入调用方提供的缓冲区, 返回写入的字节数, out_size 不够时返回 -1.
+// 编码的输出不超过 3 * len, 解码的输出不超过 len, 解码遇到非法的 %XX 也返回 -1
+int64_t URLEncode(const char *in, size_t len, char *out, size_t out_size);
+int64_t URLDecode(const char *in, size_t len, char *out, size_t out_size);
 
 int64_t GetFileSize(const char *path);
+// 在 src_str 中查找 sub_str, flag 为 true 时找第一次出现, false 时找最后一次出现, 没找到返回 NULL.
+// sub_len 为 0 时按 strlen(sub_str) 计算. 用 SIMD 同时比较首尾字节筛选候选位置
 const char *MemFind(const char *src_str, size_t src_len, const char *sub_str,
                     size_t sub_len, bool flag = true);
 
+// 预先算好跳转表(Horspool)的查找器, 同一个模式反复查找时用, 比如在上传的 body 里找 multipart 分隔符.
+// 模式越长跳得越远, 40~70 字节的分隔符在图片这类随机数据上每次比较跳过几十个字节
+class CMemSearcher {
+  public:
+    CMemSearcher(const char *pattern, size_t len);
+    explicit CMemSearcher(const string &pattern);
+
+    size_t GetLength() const { return pattern_.size(); }
+    // 第一次 / 最后一次出现的位置, 没找到返回 NULL; 空模式返回 src / src + len
+    const char *Find(const char *src, size_t len) const;
+    const char *RFind(const char *src, size_t len) const;
+
+  private:
+    void Init();
+
+    string pattern_;
+    uint32_t skip_[256];    // 正向: 窗口末字节为 c 时窗口可以右移的距离
+    uint32_t rskip_[256];   // 反向: 窗口首字节为 c 时窗口可以左移的距离
+};
+
 #endif
@@ -6,37 +6,71 @@
  */
 
 #include "util_pdu.h"
+#include "buffer_pool.h"
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 ///////////// CSimpleBuffer ////////////////
 CSimpleBuffer::CSimpleBuffer() {
     buf_ = NULL;
 
     alloc_size_ = 0;
+    read_offset_ = 0;
     write_offset_ = 0;
 }
 
 CSimpleBuffer::~CSimpleBuffer() {
-    alloc_size_ = 0;
-    write_offset_ = 0;
     if (buf_) {
-        free(buf_);
+        CBufferPool::Free(buf_, alloc_size_);
         buf_ = NULL;
     }
+    alloc_size_ = 0;
+    read_offset_ = 0;
+    write_offset_ = 0;
 }
 
-void CSimpleBuffer::Extend(uint32_t len) {
-    alloc_size_ = write_offset_ + len;
-    alloc_size_ += alloc_size_ >> 2; // increase by 1/4 allocate size
-    uchar_t *new_buf = (uchar_t *)realloc(buf_, alloc_size_);
+bool CSimpleBuffer::Extend(uint32_t len) {
+    if (alloc_size_ - write_offset_ >= len)
+        return true;
+
+    // compacting copies data_len bytes, so only do it when at least as many bytes have
+    // been consumed, or when the buffer has to grow anyway
+    uint32_t data_len = write_offset_ - read_offset_;
+    if (read_offset_ > 0 && (read_offset_ >= data_len || alloc_size_ - data_len < len)) {
+        memmove(buf_, buf_ + read_offset_, data_len);
+        read_offset_ = 0;
+        write_offset_ = data_len;
+        if (alloc_size_ - write_offset_ >= len)
+            return true;
+    }
+
+    // offsets are 32-bit, so the buffer can never hold more than UINT32_MAX bytes
+    uint64_t size = (uint64_t)write_offset_ + len;
+    if (size > UINT32_MAX)
+        return false;
+    size += size >> 2; // increase by 1/4 allocate size
+    if (size > UINT32_MAX)
+        size = UINT32_MAX;
+    // storage comes from the thread-local buffer pool, rounded up to its size class
+    size_t capacity;
+    uchar_t *new_buf = (uchar_t *)CBufferPool::Realloc(buf_, alloc_size_, write_offset_, size,
+                                                       &capacity);
+    if (new_buf == NULL)
+        return false;
     buf_ = new_buf;
+    alloc_size_ = capacity > UINT32_MAX ? UINT32_MAX : (uint32_t)capacity;
+    return true;
 }
 
 uint32_t CSimpleBuffer::Write(void *buf, uint32_t len) {
-    if (write_offset_ + len > alloc_size_) {
-        Extend(len);
-    }
+    if (alloc_size_ - write_offset_ < len && !Extend(len))
+        return 0;
 
     if (buf) {
         memcpy(buf_ + write_offset_, buf, len);
@@ -50,17 +84,27 @@ uint32_t CSimpleBuffer::Write(void *buf, uint32_t len) {
 uint32_t CSimpleBuffer::Read(void *buf, uint32_t len) {
     if (0 == len)
         return len;
-    if (len > write_offset_)
-        len = write_offset_;
+    if (len > write_offset_ - read_offset_)
+        len = write_offset_ - read_offset_;
 
     if (buf)
-        memcpy(buf, buf_, len);
+        memcpy(buf, buf_ + read_offset_, len);
 
-    write_offset_ -= len;
-    memmove(buf_, buf_ + len, write_offset_);
+    Consume(len);
     return len;
 }
 
+void CSimpleBuffer::Consume(uint32_t len) {
+    if (len < write_offset_ - read_offset_) {
+        read_offset_ += len;
+        return;
+    }
+
+    // drained: restart at the front so no compaction is ever needed
+    read_offset_ = 0;
+    write_offset_ = 0;
+}
+
 ////// CByteStream //////
 CByteStream::CByteStream(uchar_t *buf, uint32_t len) {
     buf_ = buf;
@@ -240,37 +284,263 @@ void CByteStream::_WriteByte(void *buf, uint32_t len) {
     if (buf_ && (pos_ + len > len_))
         return;
 
-    if (simple_buf_)
-        simple_buf_->Write((char *)buf, len);
-    else
+    if (simple_buf_) {
+        if (simple_buf_->Write((char *)buf, len) != len)
+            return;
+    } else {
         memcpy(buf_ + pos_, buf, len);
+    }
+
+    pos_ += len;
+}
+
+int64_t CByteStream::ReadInt64(uchar_t *buf) { return (int64_t)ReadUint64(buf); }
+
+uint64_t CByteStream::ReadUint64(uchar_t *buf) {
+    return ((uint64_t)ReadUint32(buf) << 32) | ReadUint32(buf + 4);
+}
+
+void CByteStream::WriteInt64(uchar_t *buf, int64_t data) { WriteUint64(buf, (uint64_t)data); }
+
+void CByteStream::WriteUint64(uchar_t *buf, uint64_t data) {
+    WriteUint32(buf, (uint32_t)(data >> 32));
+    WriteUint32(buf + 4, (uint32_t)data);
+}
+
+void CByteStream::operator<<(int64_t data) { WriteFixed(data); }
+
+void CByteStream::operator<<(uint64_t data) { WriteFixed(data); }
+
+void CByteStream::operator>>(int64_t &data) { ReadFixed(data); }
+
+void CByteStream::operator>>(uint64_t &data) { ReadFixed(data); }
+
+void CByteStream::WriteVarint(uint64_t data) {
+    uchar_t buf[10];
+    uint32_t len = 0;
+    while (data >= 0x80) {
+        buf[len++] = (uchar_t)(data | 0x80);
+        data >>= 7;
+    }
+    buf[len++] = (uchar_t)data;
+    _WriteByte(buf, len);
+}
+
+uint64_t CByteStream::ReadVarint() {
+    uint64_t data = 0;
+    for (uint32_t i = 0; i < 10; i++) {
+        uchar_t byte;
+        _ReadByte(&byte, 1);
+        // the 10th byte only has room for the top bit of a 64-bit value
+        if (i == 9 && byte > 1)
+            break;
+        data |= (uint64_t)(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0)
+            return data;
+    }
+
+    throw CPduException(ERROR_CODE_PARSE_FAILED, "parase varint failed!");
+}
+
+void CByteStream::SwapBytes(void *dst, const void *src, uint32_t count, uint32_t width) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dst, src, (size_t)count * width);
+#else
+    uchar_t *out = (uchar_t *)dst;
+    const uchar_t *in = (const uchar_t *)src;
+    size_t bytes = (size_t)count * width;
+    size_t i = 0;
+    if (width == 1) {
+        memcpy(out, in, bytes);
+        return;
+    }
+
+#if defined(__AVX2__)
+    // reverse each element inside its 128-bit lane
+    __m128i mask128;
+    if (width == 2)
+        mask128 = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    else if (width == 4)
+        mask128 = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    else
+        mask128 = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    __m256i mask = _mm256_broadcastsi128_si256(mask128);
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(v, mask));
+    }
+#elif defined(__SSE2__)
+    // swap the bytes of every 16-bit word, after reordering the words for 32/64-bit elements
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        if (width == 4) {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        } else if (width == 8) {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+#endif
+
+    for (; i < bytes; i += width) {
+        for (uint32_t j = 0; j < width; j++)
+            out[i + j] = in[i + width - 1 - j];
+    }
+#endif
+}
+
+uchar_t *CByteStream::_PrepareWrite(uint64_t len) {
+    if (len > UINT32_MAX)
+        return NULL;
+    if (simple_buf_)
+        return simple_buf_->Prepare((uint32_t)len);
+    if (pos_ + len > len_)
+        return NULL;
+    return buf_ + pos_;
+}
+
+void CByteStream::_CommitWrite(uint32_t len) {
+    if (simple_buf_)
+        simple_buf_->Commit(len);
+    pos_ += len;
+}
 
+uchar_t *CByteStream::_PrepareRead(uint64_t len) {
+    if (pos_ + len > len_) {
+        throw CPduException(ERROR_CODE_PARSE_FAILED, "parase packet failed!");
+    }
+
+    return simple_buf_ ? simple_buf_->GetBuffer() : buf_ + pos_;
+}
+
+void CByteStream::_CommitRead(uint32_t len) {
+    if (simple_buf_)
+        simple_buf_->Consume(len);
     pos_ += len;
 }
 
+namespace {
+// every value below 36 * 36 as two base-36 digits, so encoding divides by 1296 per step
+struct Base36Table {
+    char pairs_[1296 * 2];
+    int8_t values_[256]; // digit value of a character, -1 if not base 36
+
+    constexpr Base36Table() : pairs_(), values_() {
+        const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+        for (int i = 0; i < 1296; i++) {
+            pairs_[i * 2] = digits[i / 36];
+            pairs_[i * 2 + 1] = digits[i % 36];
+        }
+        for (int c = 0; c < 256; c++)
+            values_[c] = -1;
+        for (int i = 0; i < 36; i++) {
+            values_[(unsigned char)digits[i]] = (int8_t)i;
+            if (i >= 10)
+                values_['A' + i - 10] = (int8_t)i;
+        }
+    }
+};
+
+constexpr Base36Table kBase36;
+
+// writes '1' + base-36 value and a '\0' into out (at least kIdUrlSize bytes)
+uint32_t EncodeUrl(uint64_t value, char *out) {
+    char tmp[kIdUrlSize];
+    char *ptr = tmp + sizeof(tmp);
+    while (value >= 1296) {
+        uint32_t pair = (uint32_t)(value % 1296);
+        value /= 1296;
+        ptr -= 2;
+        memcpy(ptr, kBase36.pairs_ + pair * 2, 2);
+    }
+    if (value >= 36) {
+        ptr -= 2;
+        memcpy(ptr, kBase36.pairs_ + value * 2, 2);
+    } else {
+        *--ptr = kBase36.pairs_[value * 2 + 1];
+    }
+    *--ptr = '1'; // add version number
+
+    uint32_t len = (uint32_t)(tmp + sizeof(tmp) - ptr);
+    memcpy(out, ptr, len);
+    out[len] = '\0';
+    return len;
+}
+
+const uint64_t kMaxUrlId = (~(uint64_t)0 - 56) >> 1;
+} // namespace
+
 /*
  * Warning!!!
- * This function return a static char pointer, caller must immediately copy the
- * string to other place
+ * This function returns a per-thread static char pointer, which the next call
+ * in the same thread overwrites. Use idtourl_r / idtourl64 in new code.
  */
 char *idtourl(uint32_t id) {
-    static char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
-    static char buf[64];
-    char *ptr;
+    static thread_local char buf[kIdUrlSize];
+    // keep the 32-bit wrap-around of the original encoding
     uint32_t value = id * 2 + 56;
+    EncodeUrl(value, buf);
+    return buf;
+}
 
-    // convert to 36 number system
-    ptr = buf + sizeof(buf) - 1;
-    *ptr = '\0';
+uint32_t idtourl_r(uint64_t id, char *buf, uint32_t size) {
+    if (id > kMaxUrlId || size < kIdUrlSize) {
+        if (buf != NULL && size > 0)
+            buf[0] = '\0';
+        return 0;
+    }
 
-    do {
-        *--ptr = digits[value % 36];
-        value /= 36;
-    } while (ptr > buf && value);
+    return EncodeUrl(id * 2 + 56, buf);
+}
 
-    *--ptr = '1'; // add version number
+CIdUrl idtourl64(uint64_t id) {
+    CIdUrl url;
+    url.len_ = idtourl_r(id, url.str_, kIdUrlSize);
+    return url;
+}
+
+bool urltoid_r(const char *url, uint32_t len, uint64_t *id) {
+    if (url == NULL)
+        return false;
+    if (len == 0)
+        len = (uint32_t)strlen(url);
+    // '1' + 1..13 digits
+    if (len < 2 || len > kIdUrlSize - 2 || url[0] != '1')
+        return false;
+
+    uint64_t number = 0;
+    for (uint32_t i = 1; i < len; i++) {
+        int8_t digit = kBase36.values_[(unsigned char)url[i]];
+        if (digit < 0)
+            return false;
+        if (number > (~(uint64_t)0 - digit) / 36)
+            return false;
+        number = number * 36 + digit;
+    }
 
-    return ptr;
+    if (number < 56 || (number & 1) != 0)
+        return false;
+    *id = (number - 56) >> 1;
+    return true;
+}
+
+void idtourl_batch(const uint64_t *ids, uint32_t count, char *urls) {
+    for (uint32_t i = 0; i < count; i++)
+        idtourl_r(ids[i], urls + (size_t)i * kIdUrlSize, kIdUrlSize);
+}
+
+uint32_t urltoid_batch(const char *const *urls, uint32_t count, uint64_t *ids) {
+    uint32_t ok = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (urltoid_r(urls[i], 0, &ids[i]))
+            ok++;
+        else
+            ids[i] = kInvalidUrlId;
+    }
+    return ok;
 }
 
 uint32_t urltoid(const char *url) {
@@ -6,6 +6,8 @@
 #include <map>
 #include <set>
 #include <string>
+#include <type_traits>
+#include <vector>
 using namespace std;
 
 #ifdef WIN32
@@ -55,22 +57,59 @@ class CPduException {
     string error_msg_;
 };
 
+// Layout: [0, read_offset_) consumed, [read_offset_, write_offset_) unread data,
+// [write_offset_, alloc_size_) free space. Reads only advance read_offset_; unread data
+// is moved to the front lazily when a write needs room. GetBuffer/GetWriteOffset/
+// GetAllocSize are relative to the unread data, as they were before.
 class DLL_MODIFIER CSimpleBuffer {
   public:
     CSimpleBuffer();
     ~CSimpleBuffer();
-    uchar_t *GetBuffer() { return buf_; }
-    uint32_t GetAllocSize() { return alloc_size_; }
-    uint32_t GetWriteOffset() { return write_offset_; }
+    uchar_t *GetBuffer() { return buf_ + read_offset_; }
+    uint32_t GetAllocSize() { return alloc_size_ - read_offset_; }
+    uint32_t GetWriteOffset() { return write_offset_ - read_offset_; }
     void IncWriteOffset(uint32_t len) { write_offset_ += len; }
 
-    void Extend(uint32_t len);
+    // make room for at least len more bytes; false if the memory cannot be allocated,
+    // and the buffer is left as it was
+    bool Extend(uint32_t len);
+    // returns len, or 0 (nothing written) when the buffer cannot grow
     uint32_t Write(void *buf, uint32_t len);
     uint32_t Read(void *buf, uint32_t len);
 
+    // zero-copy access for socket I/O:
+    //     uchar_t *p = buf.Prepare(64 * 1024);
+    //     int n = recv(fd, p, 64 * 1024, 0);
+    //     if (n > 0) buf.Commit(n);
+    //     uint32_t len;
+    //     n = send(fd, buf.Peek(len), len, 0);
+    //     if (n > 0) buf.Consume(n);
+    uchar_t *Peek(uint32_t &len) {
+        len = write_offset_ - read_offset_;
+        return buf_ + read_offset_;
+    }
+    // drop len bytes from the front (all of them if len exceeds the unread data)
+    void Consume(uint32_t len);
+    // room for len bytes, NULL when the buffer cannot grow; Commit() the number actually written.
+    // Prepare(0) on a buffer that was never allocated allocates the smallest size class, so
+    // NULL always means failure
+    uchar_t *Prepare(uint32_t len) {
+        if (alloc_size_ - write_offset_ < len || buf_ == NULL) {
+            if (!Extend(len > 0 ? len : 1))
+                return NULL;
+        }
+        return buf_ + write_offset_;
+    }
+    void Commit(uint32_t len) { write_offset_ += len; }
+    uint32_t GetWritableSize() { return alloc_size_ - write_offset_; }
+
   private:
+    CSimpleBuffer(const CSimpleBuffer &);
+    CSimpleBuffer &operator=(const CSimpleBuffer &);
+
     uchar_t *buf_;
     uint32_t alloc_size_;
+    uint32_t read_offset_;
     uint32_t write_offset_;
 };
 
@@ -123,18 +162,205 @@ class CByteStream {
     void WriteData(uchar_t *data, uint32_t len);
     uchar_t *ReadData(uint32_t &len);
 
+    // 64-bit fields, big-endian like the 16/32-bit ones
+    static int64_t ReadInt64(uchar_t *buf);
+    static uint64_t ReadUint64(uchar_t *buf);
+    static void WriteInt64(uchar_t *buf, int64_t data);
+    static void WriteUint64(uchar_t *buf, uint64_t data);
+
+    void operator<<(int64_t data);
+    void operator<<(uint64_t data);
+    void operator>>(int64_t &data);
+    void operator>>(uint64_t &data);
+
+    // LEB128 varint: 7 bits per byte, low group first, at most 10 bytes
+    void WriteVarint(uint64_t data);
+    uint64_t ReadVarint();
+    // zig-zag maps small negative numbers to small varints
+    void WriteSVarint(int64_t data) { WriteVarint(((uint64_t)data << 1) ^ (uint64_t)(data >> 63)); }
+    int64_t ReadSVarint() {
+        uint64_t data = ReadVarint();
+        return (int64_t)(data >> 1) ^ -(int64_t)(data & 1);
+    }
+
+    // uint32 count followed by big-endian elements, byte-swapped in one pass. Count and
+    // elements are written together or not at all (e.g. more than UINT32_MAX bytes)
+    template <class T> void WriteArray(const T *data, uint32_t count) {
+        static_assert(_IsArrayElement<T>(), "WriteArray needs 1, 2, 4 or 8 byte integers");
+        uint64_t size = 4 + (uint64_t)count * sizeof(T);
+        uchar_t *dst = _PrepareWrite(size);
+        if (dst) {
+            WriteUint32(dst, count);
+            SwapBytes(dst + 4, data, count, sizeof(T));
+            _CommitWrite((uint32_t)size);
+        }
+    }
+    template <class T> void ReadArray(vector<T> &data) {
+        static_assert(_IsArrayElement<T>(), "ReadArray needs 1, 2, 4 or 8 byte integers");
+        uint32_t count;
+        *this >> count;
+        uchar_t *src = _PrepareRead((uint64_t)count * sizeof(T));
+        data.resize(count);
+        SwapBytes(data.data(), src, count, sizeof(T));
+        _CommitRead(count * sizeof(T));
+    }
+
+    // fixed-width fields whose total size is known at compile time: one bounds check
+    // for the whole group instead of one per field
+    //     stream.WriteFixed(service_id, command_id, seq_no);
+    template <class... Ts> void WriteFixed(Ts... data) {
+        const uint32_t size = _FixedSize<Ts...>();
+        uchar_t *dst = _PrepareWrite(size);
+        if (dst) {
+            _StoreAll(dst, data...);
+            _CommitWrite(size);
+        }
+    }
+    template <class... Ts> void ReadFixed(Ts &...data) {
+        const uint32_t size = _FixedSize<Ts...>();
+        const uchar_t *src = _PrepareRead(size);
+        _LoadAll(src, data...);
+        _CommitRead(size);
+    }
+
+    // copy count elements of width bytes (1, 2, 4 or 8) and reverse the byte order of each
+    // on little-endian hosts; uses SSE2/AVX2 when available
+    static void SwapBytes(void *dst, const void *src, uint32_t count, uint32_t width);
+
   private:
     void _WriteByte(void *buf, uint32_t len);
     void _ReadByte(void *buf, uint32_t len);
 
+    // NULL when a fixed buffer has no room, a CSimpleBuffer cannot grow or len exceeds
+    // UINT32_MAX (the write is dropped, like _WriteByte)
+    uchar_t *_PrepareWrite(uint64_t len);
+    void _CommitWrite(uint32_t len);
+    // throws CPduException when fewer than len bytes are left
+    uchar_t *_PrepareRead(uint64_t len);
+    void _CommitRead(uint32_t len);
+
+    // SwapBytes only handles these widths; bool has no fixed wire size
+    template <class T> static constexpr bool _IsArrayElement() {
+        return std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+               (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+    }
+
+    template <class... Ts> static constexpr uint32_t _FixedSize() {
+        static_assert((std::is_integral<Ts>::value && ...), "fixed fields must be integral");
+        return (0 + ... + (uint32_t)sizeof(Ts));
+    }
+    // compilers turn these loops into a single bswap + store/load
+    template <class T> static void _Store(uchar_t *&buf, T data) {
+        typename std::make_unsigned<T>::type value = data;
+        for (int i = (int)sizeof(T) - 1; i >= 0; i--) {
+            buf[i] = (uchar_t)value;
+            value = (typename std::make_unsigned<T>::type)(value >> 8);
+        }
+        buf += sizeof(T);
+    }
+    template <class T> static void _Load(const uchar_t *&buf, T &data) {
+        typename std::make_unsigned<T>::type value = 0;
+        for (size_t i = 0; i < sizeof(T); i++)
+            value = (typename std::make_unsigned<T>::type)((value << 8) | buf[i]);
+        data = (T)value;
+        buf += sizeof(T);
+    }
+    template <class... Ts> static void _StoreAll(uchar_t *buf, Ts... data) {
+        (_Store(buf, data), ...);
+    }
+    template <class... Ts> static void _LoadAll(const uchar_t *buf, Ts &...data) {
+        (_Load(buf, data), ...);
+    }
+
   private:
+    template <uint32_t N> friend class CFixedByteStream;
+
     CSimpleBuffer *simple_buf_;
     uchar_t *buf_;
     uint32_t len_;
     uint32_t pos_;
 };
 
+// CByteStream over a uchar_t[N] whose capacity is a compile-time constant, e.g. a PDU header
+// built on the stack. Everything is inline, so with a local stream the position is known to
+// the compiler and the bounds checks fold away; groups larger than N fail to compile.
+// Overflow behaves like CByteStream: writes are dropped, reads throw CPduException.
+//     uchar_t header[16];
+//     CFixedByteStream<16> stream(header);
+//     stream.WriteFixed(length, version, flag, service_id, command_id, seq_no, reserved);
+// WriteFixedAt / ReadFixedAt take the offset as a template argument and check nothing at
+// run time.
+template <uint32_t N> class CFixedByteStream {
+  public:
+    explicit CFixedByteStream(uchar_t (&buf)[N]) : buf_(buf), pos_(0) {}
+
+    uchar_t *GetBuf() { return buf_; }
+    uint32_t GetPos() { return pos_; }
+    uint32_t GetLen() { return N; }
+
+    template <class... Ts> void WriteFixed(Ts... data) {
+        const uint32_t size = CByteStream::_FixedSize<Ts...>();
+        static_assert(size <= N, "fixed group larger than the buffer");
+        if (pos_ <= N - size) {
+            CByteStream::_StoreAll(buf_ + pos_, data...);
+            pos_ += size;
+        }
+    }
+    template <class... Ts> void ReadFixed(Ts &...data) {
+        const uint32_t size = CByteStream::_FixedSize<Ts...>();
+        static_assert(size <= N, "fixed group larger than the buffer");
+        if (pos_ > N - size) {
+            throw CPduException(ERROR_CODE_PARSE_FAILED, "parase packet failed!");
+        }
+        CByteStream::_LoadAll(buf_ + pos_, data...);
+        pos_ += size;
+    }
+
+    // fields at byte offset Pos, independent of the stream position
+    template <uint32_t Pos, class... Ts> void WriteFixedAt(Ts... data) {
+        static_assert(Pos + CByteStream::_FixedSize<Ts...>() <= N,
+                      "fixed group beyond the end of the buffer");
+        CByteStream::_StoreAll(buf_ + Pos, data...);
+    }
+    template <uint32_t Pos, class... Ts> void ReadFixedAt(Ts &...data) const {
+        static_assert(Pos + CByteStream::_FixedSize<Ts...>() <= N,
+                      "fixed group beyond the end of the buffer");
+        CByteStream::_LoadAll(buf_ + Pos, data...);
+    }
+
+  private:
+    uchar_t *buf_;
+    uint32_t pos_;
+};
+
+// Share-link ids: '1' (format version) followed by id * 2 + 56 in lowercase base 36.
+// idtourl returns a per-thread static buffer that the next call overwrites.
 char *idtourl(uint32_t id);
 uint32_t urltoid(const char *url);
 
+// Reentrant 64-bit versions. For ids where the 32-bit idtourl does not wrap (< 2^31 - 28)
+// the output is identical, so existing links keep decoding. Ids must be below 2^63 - 28.
+static const uint32_t kIdUrlSize = 16; // '1' + up to 13 base-36 digits + '\0'
+
+struct CIdUrl {
+    char str_[kIdUrlSize];
+    uint32_t len_; // 0 when the id is out of range
+
+    const char *c_str() const { return str_; }
+};
+
+// writes the '\0'-terminated url into buf, returns its length (0 if the id is out of
+// range or size is too small)
+uint32_t idtourl_r(uint64_t id, char *buf, uint32_t size);
+CIdUrl idtourl64(uint64_t id);
+// strict decode: rejects a wrong version, non base-36 characters, overflow and values
+// that no id maps to. len 0 means strlen(url)
+bool urltoid_r(const char *url, uint32_t len, uint64_t *id);
+
+// batch forms for list pages: urls is count slots of kIdUrlSize bytes each
+void idtourl_batch(const uint64_t *ids, uint32_t count, char *urls);
+// failed entries are set to kInvalidUrlId; returns the number decoded successfully
+static const uint64_t kInvalidUrlId = ~(uint64_t)0;
+uint32_t urltoid_batch(const char *const *urls, uint32_t count, uint64_t *ids);
+
 #endif /* UTILPDU_H_ */